@@ -1,6 +1,7 @@
 // $Id: bigint.cpp,v 1.6 2016-01-18 00:37:37-08 - - $
 // Ana Carolina Alves - adalves
 
+#include <cctype>
 #include <cstdlib>
 #include <exception>
 #include <stack>
@@ -24,6 +25,17 @@ bigint::bigint (const string& that) {
    uvalue = ubigint (that.substr (is_negative ? 1 : 0));
 }
 
+//
+// Builds a value from a range of characters, such as a memory-mapped
+// file.  Either '_' or '-' may be used as the sign, so that output
+// printed by ydc can be read back.
+//
+bigint::bigint (const char* first, const char* last) {
+   is_negative = first != last and (*first == '_' or *first == '-');
+   uvalue = ubigint (is_negative ? first + 1 : first, last);
+   deal_with_zero (*this);
+}
+
 bigint bigint::operator+() const {
    return *this;
 }
@@ -177,3 +189,25 @@ ostream& operator<< (ostream& out, const bigint& that) {
    return out;
 }
 
+
+//
+// Writes the value in binary form: one sign byte (1 if negative)
+// followed by the magnitude as written by ubigint::save.
+//
+void bigint::save (ostream& out) const {
+   out.put (is_negative ? 1 : 0);
+   uvalue.save (out);
+}
+
+//
+// Reads a value written by save, replacing the current value.
+//
+void bigint::load (istream& in) {
+   int sign = in.get();
+   if (sign != 0 and sign != 1) {
+      throw runtime_error ("bigint::load: bad sign");
+   }
+   uvalue.load (in);
+   is_negative = sign == 1;
+   deal_with_zero (*this);
+}
@@ -26,6 +26,7 @@ class bigint {
       bigint (long);
       bigint (const ubigint&, bool is_negative = false);
       explicit bigint (const string&);
+      bigint (const char* first, const char* last);
 
       bigint operator+() const;
       bigint operator-() const;
@@ -38,6 +39,9 @@ class bigint {
       bool operator== (const bigint&) const;
       bool operator<  (const bigint&) const;
       void deal_with_zero(bigint&) const;
+
+      void save (ostream&) const;
+      void load (istream&);
 };
 
 #endif
@@ -3,18 +3,17 @@
 
 #include <climits>
 #include <iostream>
-#include <vector>
 using namespace std;
 
 #include "debug.h"
 #include "general.h"
 
-vector<bool> debugflags::flags (UCHAR_MAX + 1, false);
+debugflags::flagset debugflags::flags {};
 
 void debugflags::setflags (const string& initflags) {
    for (const unsigned char flag: initflags) {
-      if (flag == '@') flags.assign (flags.size(), true);
-                  else flags[flag] = true;
+      if (flag == '@') flags.set();
+                  else flags.set (flag, true);
    }
    // Note that DEBUGF can trace setflags.
    if (getflag ('x')) {
@@ -26,15 +25,6 @@ void debugflags::setflags (const string& initflags) {
    }
 }
 
-//
-// getflag -
-//    Check to see if a certain flag is on.
-//
-
-bool debugflags::getflag (char flag) {
-   return flags[static_cast<unsigned char> (flag)];
-}
-
 void debugflags::where (char flag, const char* file, int line,
                         const char* func) {
    note() << "DEBUG(" << flag << ") " << file << "[" << line << "] "
@@ -0,0 +1,59 @@
+// $Id$
+// Ana Carolina Alves - adalves
+
+//
+// debugbench -
+//    Measures the cost of a DEBUGF whose flag is off.  Built twice by
+//    `make bench', once normally and once with -DNDEBUG, so the two
+//    figures show the per-call overhead of the runtime flag check and
+//    of the compiled-out macro.
+//
+
+#include <chrono>
+#include <iostream>
+using namespace std;
+
+#include "debug.h"
+#include "general.h"
+
+//
+// The work is done in functions that are not inlined, so that the
+// flag is loaded on every call rather than hoisted out of the loop,
+// as it would be in a real hot path.
+//
+volatile long sink = 0;
+
+__attribute__((noinline)) void plain (long count) {
+   sink = count;
+}
+
+__attribute__((noinline)) void traced (long count) {
+   sink = count;
+   DEBUGF ('b', "count = " << count);
+}
+
+int main (int, char** argv) {
+   exec::execname (argv[0]);
+   constexpr long iterations = 100000000;
+   using clock = chrono::steady_clock;
+
+   auto start = clock::now();
+   for (long count = 0; count < iterations; ++count) plain (count);
+   auto middle = clock::now();
+   for (long count = 0; count < iterations; ++count) traced (count);
+   auto finish = clock::now();
+
+   double empty_ns = chrono::duration<double, nano> (middle - start)
+                     .count() / iterations;
+   double debugf_ns = chrono::duration<double, nano> (finish - middle)
+                      .count() / iterations;
+#ifdef NDEBUG
+   cout << "NDEBUG:";
+#else
+   cout << "DEBUGF:";
+#endif
+   cout << " loop " << empty_ns << " ns, with DEBUGF " << debugf_ns
+        << " ns, overhead " << debugf_ns - empty_ns << " ns/call"
+        << endl;
+   return exec::status();
+}
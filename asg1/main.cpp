@@ -2,13 +2,19 @@
 // Ana Carolina Alves - adalves
 
 #include <cassert>
+#include <cctype>
+#include <cstdint>
 #include <deque>
+#include <fstream>
 #include <iostream>
 #include <map>
 #include <stdexcept>
 #include <utility>
 using namespace std;
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "bigint.h"
@@ -16,6 +22,7 @@ using namespace std;
 #include "general.h"
 #include "iterstack.h"
 #include "libfns.h"
+#include "profile.h"
 #include "scanner.h"
 
 using bigint_stack = iterstack<bigint>;
@@ -62,9 +69,107 @@ void do_print (bigint_stack& stack, const char) {
    cout << stack.top() << endl;
 }
 
-void do_debug (bigint_stack& stack, const char) {
-   (void) stack; // SUPPRESS: warning: unused parameter 'stack'
-   cout << "Y not implemented" << endl;
+//
+// do_debug -
+//    Prints the ubigint cost counters accumulated so far.
+//
+void do_debug (bigint_stack&, const char) {
+   profile::print (cout);
+}
+
+//
+// Stack checkpoints.  The file starts with the magic bytes "ydc",
+// a format version byte, and the number of elements as a 64-bit
+// little-endian count, followed by each element as written by
+// bigint::save, from the top of the stack to the bottom.
+//
+string stack_filename = "ydc.stack";
+const string stack_magic = {'y', 'd', 'c', 1};
+
+void do_save (bigint_stack& stack, const char) {
+   ofstream out (stack_filename, ios::binary);
+   if (not out) throw ydc_exn (stack_filename + ": cannot open");
+   out.write (stack_magic.data(), stack_magic.size());
+   uint64_t count = stack.size();
+   for (size_t i = 0; i < sizeof count; ++i) {
+      out.put (static_cast<char> (count >> (i * 8)));
+   }
+   for (const auto &elem: stack) elem.save (out);
+   out.close();
+   if (not out) throw ydc_exn (stack_filename + ": write error");
+   DEBUGF ('d', "saved " << count << " to " << stack_filename);
+}
+
+void do_load (bigint_stack& stack, const char) {
+   ifstream in (stack_filename, ios::binary);
+   if (not in) throw ydc_exn (stack_filename + ": cannot open");
+   string magic (stack_magic.size(), '\0');
+   in.read (&magic[0], magic.size());
+   if (magic != stack_magic) {
+      throw ydc_exn (stack_filename + ": not a ydc stack");
+   }
+   uint64_t count = 0;
+   for (size_t i = 0; i < sizeof count; ++i) {
+      count |= static_cast<uint64_t> (in.get() & 0xFF) << (i * 8);
+   }
+   vector<bigint> elems;
+   try {
+      for (uint64_t i = 0; i < count; ++i) {
+         elems.emplace_back();
+         elems.back().load (in);
+      }
+   }catch (runtime_error& exn) {
+      throw ydc_exn (stack_filename + ": " + exn.what());
+   }
+   stack.clear();
+   for (auto itor = elems.crbegin(); itor != elems.crend(); ++itor) {
+      stack.push (*itor);
+   }
+   DEBUGF ('d', "loaded " << count << " from " << stack_filename);
+}
+
+//
+// push_file -
+//    Push the numbers contained in a file named on the command line,
+//    in the order they appear.  Numbers are separated by whitespace
+//    and may be continued across lines with a backslash, as printed
+//    by ydc.  The file is mapped into memory and each number is
+//    parsed in place, so only one copy of a value is ever held.
+//
+void push_file (bigint_stack& stack, const string& filename) {
+   int fd = open (filename.c_str(), O_RDONLY);
+   if (fd < 0) throw ydc_exn (filename + ": cannot open");
+   struct stat stat_buf;
+   if (fstat (fd, &stat_buf) < 0 or stat_buf.st_size == 0) {
+      close (fd);
+      throw ydc_exn (filename + ": no number");
+   }
+   size_t length = stat_buf.st_size;
+   void* map = mmap (nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+   close (fd);
+   if (map == MAP_FAILED) throw ydc_exn (filename + ": cannot map");
+   madvise (map, length, MADV_SEQUENTIAL);
+   const char* itor = static_cast<const char*> (map);
+   const char* end = itor + length;
+   for (;;) {
+      while (itor != end and isspace (*itor)) ++itor;
+      if (itor == end) break;
+      const char* first = itor;
+      if (*itor == '_' or *itor == '-') ++itor;
+      while (itor != end) {
+         if (isdigit (*itor)) ++itor;
+         else if (*itor == '\\' and itor + 1 != end
+                  and itor[1] == '\n') itor += 2;
+         else break;
+      }
+      if (itor != end and not isspace (*itor)) {
+         munmap (map, length);
+         throw ydc_exn (filename + ": not a number");
+      }
+      stack.push (bigint (first, itor));
+      DEBUGF ('d', filename << ": " << stack.top());
+   }
+   munmap (map, length);
 }
 
 class ydc_quit: public exception {};
@@ -81,6 +186,8 @@ fn_map do_functions = {
    {"/", do_arith},
    {"%", do_arith},
    {"^", do_arith},
+   {"L", do_load },
+   {"S", do_save },
    {"Y", do_debug},
    {"c", do_clear},
    {"d", do_dup},
@@ -91,26 +198,28 @@ fn_map do_functions = {
 
 //
 // scan_options
-//    Options analysis:  The only option is -Dflags. 
+//    Options analysis:  -@flags sets debug flags, and -s filename
+//    names the file used by the S and L stack checkpoint commands.
+//    Operands are files whose numbers are pushed before reading cin.
 //
 void scan_options (int argc, char** argv) {
    opterr = 0;
    for (;;) {
-      int option = getopt (argc, argv, "@:");
+      int option = getopt (argc, argv, "@:s:");
       if (option == EOF) break;
       switch (option) {
          case '@':
             debugflags::setflags (optarg);
             break;
+         case 's':
+            stack_filename = optarg;
+            break;
          default:
             error() << "-" << static_cast<char> (optopt)
                     << ": invalid option" << endl;
             break;
       }
    }
-   if (optind < argc) {
-      error() << "operand not permitted" << endl;
-   }
 }
 
 //
@@ -120,6 +229,13 @@ int main (int argc, char** argv) {
    exec::execname (argv[0]);
    scan_options (argc, argv);
    bigint_stack operand_stack;
+   for (int argi = optind; argi < argc; ++argi) {
+      try {
+         push_file (operand_stack, argv[argi]);
+      }catch (ydc_exn& exn) {
+         error() << exn.what() << endl;
+      }
+   }
    scanner input;
    try {
       for (;;) {
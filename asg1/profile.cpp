@@ -0,0 +1,61 @@
+// $Id$
+// Ana Carolina Alves - adalves
+
+#include <iomanip>
+#include <iostream>
+using namespace std;
+
+#include "profile.h"
+
+profile::counters profile::table[profile::NUM_OPS];
+
+void profile::record (profile_op op, size_t digits,
+                      uint64_t nanoseconds, size_t bytes) {
+   counters& entry = table[static_cast<size_t> (op)];
+   ++entry.calls;
+   entry.nanoseconds += nanoseconds;
+   entry.bytes += bytes;
+   size_t bucket = 0;
+   while (digits != 0 and bucket < NUM_BUCKETS - 1) {
+      digits >>= 1;
+      ++bucket;
+   }
+   ++entry.sizes[bucket];
+}
+
+//
+// Prints one line per operation that has been called, followed by
+// the non-empty operand size buckets for that operation.
+//
+void profile::print (ostream& out) {
+   out << setw(4) << "op" << setw(12) << "calls" << setw(16) << "usec"
+       << setw(16) << "bytes" << endl;
+   for (size_t op = 0; op < NUM_OPS; ++op) {
+      const counters& entry = table[op];
+      if (entry.calls == 0) continue;
+      out << setw(4) << static_cast<profile_op> (op)
+          << setw(12) << entry.calls
+          << setw(16) << entry.nanoseconds / 1000
+          << setw(16) << entry.bytes << endl;
+      for (size_t bucket = 0; bucket < NUM_BUCKETS; ++bucket) {
+         if (entry.sizes[bucket] == 0) continue;
+         out << setw(16) << "digits < 2^" << setw(2) << left << bucket
+             << right << setw(12) << entry.sizes[bucket] << endl;
+      }
+   }
+}
+
+void profile::reset() {
+   for (counters& entry: table) entry = counters();
+}
+
+ostream& operator<< (ostream& out, profile_op op) {
+   switch (op) {
+      case profile_op::ADD: out << "+"; break;
+      case profile_op::SUB: out << "-"; break;
+      case profile_op::MUL: out << "*"; break;
+      case profile_op::DIV: out << "/%"; break;
+      case profile_op::CMP: out << "<=>"; break;
+   }
+   return out;
+}
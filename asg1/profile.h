@@ -0,0 +1,76 @@
+// $Id$
+// Ana Carolina Alves - adalves
+
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+using namespace std;
+
+//
+// profile -
+//    static class for maintaining cost counters for the ubigint
+//    arithmetic operations.  For each kind of operation it keeps the
+//    number of calls, the total time spent, the number of bytes
+//    allocated for results, and a histogram of operand sizes, where
+//    bucket n counts operands of fewer than 2^n digits.  Times are
+//    inclusive, so the multiplications done by divide are counted
+//    both as multiplications and as part of the division.
+// record -
+//    Called by profile_timer.  Not to be called by user code.
+// print -
+//    Prints a table of the counters, used by the ydc Y command.
+// reset -
+//    Clears all counters.
+//
+
+enum class profile_op {ADD, SUB, MUL, DIV, CMP};
+
+class profile {
+   public:
+      static constexpr size_t NUM_OPS = 5;
+      static constexpr size_t NUM_BUCKETS = 40;
+   private:
+      struct counters {
+         uint64_t calls {0};
+         uint64_t nanoseconds {0};
+         uint64_t bytes {0};
+         uint64_t sizes[NUM_BUCKETS] {};
+      };
+      static counters table[NUM_OPS];
+   public:
+      static void record (profile_op op, size_t digits,
+                          uint64_t nanoseconds, size_t bytes);
+      static void print (ostream& out);
+      static void reset();
+};
+
+//
+// profile_timer -
+//    Measures one operation from construction to destruction.  The
+//    bytes member may be set before destruction to report how much
+//    storage the result allocated.
+//
+
+class profile_timer {
+   private:
+      using clock = chrono::steady_clock;
+      profile_op op;
+      size_t digits;
+      clock::time_point start;
+   public:
+      size_t bytes {0};
+      profile_timer (profile_op op, size_t digits):
+                     op (op), digits (digits), start (clock::now()) {}
+      ~profile_timer() {
+         auto elapsed = chrono::duration_cast<chrono::nanoseconds>
+                        (clock::now() - start).count();
+         profile::record (op, digits, elapsed, bytes);
+      }
+};
+
+ostream& operator<< (ostream&, profile_op);
+
+#endif
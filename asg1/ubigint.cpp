@@ -1,6 +1,9 @@
 // $Id: ubigint.cpp,v 1.16 2016-01-18 00:37:37-08 - - $
 // Ana Carolina Alves - adalves
 
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
 #include <cstdlib>
 #include <exception>
 #include <stack>
@@ -9,6 +12,7 @@ using namespace std;
 
 #include "ubigint.h"
 #include "debug.h"
+#include "profile.h"
 
 ubigint::ubigint (unsigned long that) {
    assign_vector (to_string(that));
@@ -18,6 +22,26 @@ ubigint::ubigint (const string& that) {
    assign_vector (that);
 }
 
+//
+// Builds the value directly from a range of characters, such as a
+// memory-mapped file, without an intermediate string.  The digits
+// are counted first so that storage is allocated exactly once, then
+// appended in text order and reversed in place.  Backslashes
+// and whitespace are skipped, so the line-continued output of
+// operator<< can be read back.
+//
+ubigint::ubigint (const char* first, const char* last) {
+   ubig_value.reserve (count_if (first, last, ::isdigit));
+   for (; first != last; ++first) {
+      if (isdigit (*first)) {
+         ubig_value.push_back (*first - '0');
+      }else if (*first != '\\' and not isspace (*first)) {
+         throw invalid_argument ("ubigint: bad digit");
+      }
+   }
+   reverse (ubig_value.begin(), ubig_value.end());
+}
+
 //
 // Stores the digits from least significant order to most significant
 //
@@ -31,6 +55,8 @@ void ubigint::assign_vector (const string& that) {
 // Overloads the + operator
 //
 ubigint ubigint::operator+ (const ubigint& that) const {
+   size_t digits = max (ubig_value.size(), that.ubig_value.size());
+   profile_timer timer (profile_op::ADD, digits);
    ubigint result;
    auto min_itor = ubig_value.cbegin();
    auto min_itor_end = ubig_value.cend();
@@ -79,6 +105,7 @@ ubigint ubigint::operator+ (const ubigint& that) const {
    if (carry != 0)
    result.ubig_value.push_back (1);
 
+   timer.bytes = result.ubig_value.capacity();
    return result;
 }
 
@@ -88,6 +115,7 @@ ubigint ubigint::operator+ (const ubigint& that) const {
 //
 ubigint ubigint::operator- (const ubigint& that) const {
    if (*this < that) throw domain_error ("ubigint::operator-(a<b)");
+   profile_timer timer (profile_op::SUB, ubig_value.size());
    
    ubigint result;
    auto this_itor = ubig_value.cbegin();
@@ -131,6 +159,7 @@ ubigint ubigint::operator- (const ubigint& that) const {
    
    remove_high_order_zeros (result);
 
+   timer.bytes = result.ubig_value.capacity();
    return result;
 }
 
@@ -138,6 +167,8 @@ ubigint ubigint::operator- (const ubigint& that) const {
 // Multiplies two values
 //
 ubigint ubigint::operator* (const ubigint& that) const {
+   size_t digits = max (ubig_value.size(), that.ubig_value.size());
+   profile_timer timer (profile_op::MUL, digits);
    ubigint result;
    result.ubig_value.resize(ubig_value.size() + 
                             that.ubig_value.size());
@@ -161,6 +192,7 @@ ubigint ubigint::operator* (const ubigint& that) const {
   
    remove_high_order_zeros(result);
 
+   timer.bytes = result.ubig_value.capacity();
    return result;
 }
 
@@ -203,6 +235,7 @@ void ubigint::divide_by_2() {
 // using the ancient Egyptian algorithm
 //
 ubigint::quot_rem ubigint::divide (const ubigint& that) const {
+   profile_timer timer (profile_op::DIV, ubig_value.size());
    static const ubigint zero = 0;
    if (that == zero) throw domain_error ("ubigint::divide: by 0");
    ubigint power_of_2 = 1;
@@ -223,7 +256,9 @@ ubigint::quot_rem ubigint::divide (const ubigint& that) const {
       remove_high_order_zeros (power_of_2);
       remove_high_order_zeros (divisor);
    }
-   
+
+   timer.bytes = quotient.ubig_value.capacity()
+               + remainder.ubig_value.capacity();
    return {quotient, remainder};
 }
 
@@ -249,6 +284,7 @@ ubigint ubigint::operator% (const ubigint& that) const {
 // them to determine the equality
 //
 bool ubigint::operator== (const ubigint& that) const {
+   profile::record (profile_op::CMP, ubig_value.size(), 0, 0);
    if (ubig_value.size() != that.ubig_value.size()) {
       return false;
    } else {
@@ -268,6 +304,7 @@ bool ubigint::operator== (const ubigint& that) const {
 // them to determine the result
 //
 bool ubigint::operator< (const ubigint& that) const {
+   profile::record (profile_op::CMP, ubig_value.size(), 0, 0);
    if (ubig_value.size() < that.ubig_value.size()) return true;
    else if (ubig_value.size() > that.ubig_value.size()) return false;
    else {
@@ -316,3 +353,41 @@ ostream& operator<< (ostream& out, const ubigint& that) {
    return out;
 }
 
+
+//
+// Writes the value in binary form: the number of digits as a
+// 64-bit little-endian count, followed by the digits themselves
+// from least significant to most significant, one byte each.
+// This is exactly the layout of ubig_value, so the digits are
+// written with a single call.
+//
+void ubigint::save (ostream& out) const {
+   uint64_t count = ubig_value.size();
+   for (size_t i = 0; i < sizeof count; ++i) {
+      out.put (static_cast<char> (count >> (i * 8)));
+   }
+   out.write (reinterpret_cast<const char*> (ubig_value.data()),
+              ubig_value.size());
+}
+
+//
+// Reads a value written by save, replacing the current value.
+// Throws runtime_error if the input is truncated or contains
+// something other than a decimal digit.
+//
+void ubigint::load (istream& in) {
+   uint64_t count = 0;
+   for (size_t i = 0; i < sizeof count; ++i) {
+      int byte = in.get();
+      if (byte == EOF) throw runtime_error ("ubigint::load: truncated");
+      count |= static_cast<uint64_t> (byte) << (i * 8);
+   }
+   ubig_value.resize (count);
+   in.read (reinterpret_cast<char*> (ubig_value.data()), count);
+   if (static_cast<uint64_t> (in.gcount()) != count) {
+      throw runtime_error ("ubigint::load: truncated");
+   }
+   for (udigit_t digit: ubig_value) {
+      if (digit >= 10) throw runtime_error ("ubigint::load: bad digit");
+   }
+}
@@ -8,6 +8,7 @@
 #include <iostream>
 #include <limits>
 #include <utility>
+#include <vector>
 using namespace std;
 
 #include "debug.h"
@@ -31,6 +32,7 @@ class ubigint {
       ubigint() = default; // Need default ctor as well.
       ubigint (unsigned long);
       ubigint (const string&);
+      ubigint (const char* first, const char* last);
 
       ubigint operator+ (const ubigint&) const;
       ubigint operator- (const ubigint&) const;
@@ -42,6 +44,9 @@ class ubigint {
       bool operator<  (const ubigint&) const;
 
       string print_string () const;
+
+      void save (ostream&) const;
+      void load (istream&);
 };
 
 #endif
@@ -1,38 +1,136 @@
 // $Id: commands.cpp,v 1.22 2016-01-31 22:09:08-08 - - $
 // Ana Carolina Alves - adalves
 
+#include <cstdio>
+
 #include "commands.h"
 #include "debug.h"
 
-command_hash cmd_hash {
-   {"#"     , fn_hash  },
-   {"cat"   , fn_cat   },
-   {"cd"    , fn_cd    },
-   {"echo"  , fn_echo  },
-   {"exit"  , fn_exit  },
-   {"ls"    , fn_ls    },
-   {"lsr"   , fn_lsr   },
-   {"make"  , fn_make  },
-   {"mkdir" , fn_mkdir },
-   {"prompt", fn_prompt},
-   {"pwd"   , fn_pwd   },
-   {"rm"    , fn_rm    },
-   {"rmr"   , fn_rmr   },
+// command_table -
+//    Every command, in alphabetical order, with the access to the
+//    tree it needs.  A command added here is placed in the dispatch
+//    table automatically.
+
+constexpr command_access NONE = command_access::NONE;
+constexpr command_access READ = command_access::READ;
+constexpr command_access WRITE = command_access::WRITE;
+
+constexpr command_entry command_table[] {
+   {"#"       , fn_hash    , NONE },
+   {"cat"     , fn_cat     , READ },
+   {"cd"      , fn_cd      , READ },
+   {"diff"    , fn_diff    , READ },
+   {"echo"    , fn_echo    , NONE },
+   {"exit"    , fn_exit    , NONE },
+   {"find"    , fn_find    , READ },
+   {"grep"    , fn_grep    , READ },
+   {"ln"      , fn_ln      , WRITE},
+   {"ls"      , fn_ls      , READ },
+   {"load"    , fn_load    , WRITE},
+   {"lsr"     , fn_lsr     , READ },
+   {"make"    , fn_make    , WRITE},
+   {"mkdir"   , fn_mkdir   , WRITE},
+   {"prompt"  , fn_prompt  , NONE },
+   {"pwd"     , fn_pwd     , READ },
+   {"restore" , fn_restore , WRITE},
+   {"rm"      , fn_rm      , WRITE},
+   {"rmr"     , fn_rmr     , WRITE},
+   {"save"    , fn_save    , READ },
+   {"snapshot", fn_snapshot, WRITE},
+   {"stats"   , fn_stats   , READ },
+};
+
+constexpr size_t COMMAND_COUNT = size (command_table);
+constexpr size_t DISPATCH_SIZE = 64;  // power of 2, > COMMAND_COUNT
+
+// command_hash -
+//    Hashes a nonempty name by its first and last chars and its
+//    length, with weights that make_command_hash searches for at
+//    compile time until no two commands collide.
+
+struct command_hash {
+   size_t first {0};
+   size_t last {0};
+   size_t length {0};
+   constexpr size_t operator() (string_view name) const {
+      return (static_cast<unsigned char> (name.front()) * first
+            + static_cast<unsigned char> (name.back()) * last
+            + name.size() * length) % DISPATCH_SIZE;
+   }
 };
 
-command_fn find_command_fn (const string& cmd) {
-   // Note: value_type is pair<const key_type, mapped_type>
-   // So: iterator->first is key_type (string)
-   // So: iterator->second is mapped_type (command_fn)
-   const auto result = cmd_hash.find (cmd);
-   if (result == cmd_hash.end()) {
-      throw command_error (cmd + ": No such function");
+constexpr bool is_perfect (const command_hash& hash) {
+   bool used[DISPATCH_SIZE] {};
+   for (const command_entry& entry: command_table) {
+      size_t slot = hash (entry.name);
+      if (used[slot]) return false;
+      used[slot] = true;
    }
-   return result->second;
+   return true;
 }
 
-command_error::command_error (const string& what):
-            runtime_error (what) {
+constexpr command_hash make_command_hash() {
+   for (size_t length = 0; length < DISPATCH_SIZE; ++length) {
+      for (size_t last = 0; last < DISPATCH_SIZE; ++last) {
+         for (size_t first = 1; first < DISPATCH_SIZE; ++first) {
+            command_hash hash {first, last, length};
+            if (is_perfect (hash)) return hash;
+         }
+      }
+   }
+   return {};
+}
+
+constexpr command_hash dispatch_hash = make_command_hash();
+static_assert (dispatch_hash.first != 0,
+               "no perfect hash for the command names; "
+               "increase DISPATCH_SIZE");
+
+// dispatch_table -
+//    Maps each hash value to the index of the command with that
+//    hash, or to COMMAND_COUNT if there is none.
+
+struct dispatch_table {
+   size_t index[DISPATCH_SIZE] {};
+   constexpr dispatch_table() {
+      for (size_t slot = 0; slot < DISPATCH_SIZE; ++slot) {
+         index[slot] = COMMAND_COUNT;
+      }
+      for (size_t cmd = 0; cmd < COMMAND_COUNT; ++cmd) {
+         index[dispatch_hash (command_table[cmd].name)] = cmd;
+      }
+   }
+};
+
+constexpr dispatch_table dispatch;
+
+const command_entry* find_command (string_view cmd) {
+   if (cmd.empty()) return nullptr;
+   size_t cmd_index = dispatch.index[dispatch_hash (cmd)];
+   if (cmd_index == COMMAND_COUNT) return nullptr;
+   const command_entry& entry = command_table[cmd_index];
+   return entry.name == cmd ? &entry : nullptr;
+}
+
+//
+// The line is put together first and written with one call, rather
+// than through complain(), so the reports of sessions running at
+// once are not interleaved.  Each thread reuses its own line.
+//
+void report (const command_status& status) {
+   thread_local string line;
+   line = execname();
+   line += ": ";
+   line += status.name;
+   line += ": ";
+   if (!status.operand.empty()) {
+      line += status.operand;
+      line += ": ";
+   }
+   line += status.message;
+   line += "\n";
+   exit_status::set (EXIT_FAILURE);
+   cerr << line << flush;
 }
 
 int exit_status_message() {
@@ -41,77 +139,121 @@ int exit_status_message() {
    return exit_status;
 }
 
-void fn_hash(inode_state&, const wordvec&) { }
+// expand_operand -
+//    The entries an operand names:  those matching it if it has
+//    wildcards and matches anything, and otherwise the one it names
+//    literally, or else a failure with the message missing.  The
+//    name of a literal match is the operand itself, whose last
+//    component ls prints.
+
+static command_status expand_operand (inode_state& state,
+                                      string_view command,
+                                      string_view operand,
+                                      const char* missing,
+                                      vector<glob_match>& matches) {
+   matches.clear();
+   if (glob_pattern::has_wildcards (operand)) {
+      state.glob (operand, matches);
+      if (!matches.empty()) return {};
+   }
+   inode_ptr ptr = state.pathname_to_inode_ptr (operand);
+   if (ptr == nullptr) {
+      return {command, operand, missing};
+   }
+   matches.push_back ({nullptr, string (operand), ptr});
+   return {};
+}
 
-void fn_cat (inode_state& state, const wordvec& words){
+command_status fn_hash (inode_state&, const token_list&) {
+   return {};
+}
+
+command_status fn_cat (inode_state& state, const token_list& words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
    
    if (words.size() == 1) 
-      throw command_error ("cat: No file specified");
+      return {"cat", {}, "No file specified"};
    else {
-      inode_ptr ptr;
-      auto itor = ++words.cbegin();
-      string pathname;
-      wordvec file;
+      vector<glob_match> matches;
+      auto itor = words.begin() + 1;
+      string_view pathname;
    
       for (; itor != words.end(); ++itor){
          pathname = *itor;
-         ptr = state.pathname_to_inode_ptr (pathname);
-
-         if (ptr != nullptr) {
-            if (ptr -> get_type() ==  file_type::DIRECTORY_TYPE)
-               throw command_error ("cat: " + pathname 
-                                    + ": Is a directory");
-            else file = state.get_content (ptr) -> readfile();
-         } else throw command_error ("cat: " + pathname 
-                                     + ": No such file");
-
-         cout << word_range (file.begin(), file.end()) << endl;
+         command_status status =
+               expand_operand (state, "cat", pathname,
+                               "No such file", matches);
+         if (!status) return status;
+
+         for (const glob_match& match: matches) {
+            if (match.ptr -> get_type() ==  file_type::DIRECTORY_TYPE)
+               return {"cat", pathname, "Is a directory"};
+            state.out() << state.get_content (match.ptr) -> readfile()
+                        << endl;
+         }
       }
    }
+   return {};
 }
 
-void fn_cd (inode_state& state, const wordvec& words){
+command_status fn_cd (inode_state& state, const token_list& words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
 
    if (words.size() == 1) {
       state.set_cwd(state.get_root());
    } else if (words.size() > 2) {
-      throw command_error ("cd: More than one operand given");
+      return {"cd", {}, "More than one operand given"};
    } else {
       inode_ptr ptr = state.pathname_to_inode_ptr (words.at(1));
       if (ptr != nullptr) {
          if (ptr -> get_type() ==  file_type::PLAIN_TYPE)
-            throw command_error ("cd: " + words.at(1)
-                                 + ": Is a file");
+            return {"cd", words.at(1), "Is a file"};
          else state.set_cwd(ptr);
-      } else throw command_error ("cd: " + words.at(1)
-                                  + ": No such directory");
+      } else return {"cd", words.at(1), "No such directory"};
+   }
+   return {};
+}
+
+command_status fn_diff (inode_state& state, const token_list& words){
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+
+   if (words.size() == 1) {
+      return {"diff", {}, "No snapshot specified"};
+   } else if (words.size() > 2) {
+      return {"diff", {}, "More than one operand given"};
    }
+   result<wordvec> lines =
+         state.get_tree().diff_snapshot (string (words.at(1)));
+   if (!lines) return {"diff", words.at(1), lines.error()};
+   string buffer;
+   for (const string& line: lines.value()) {
+      buffer += line;
+      buffer += "\n";
+   }
+   state.out() << buffer;
+   return {};
 }
 
-void fn_echo (inode_state& state, const wordvec& words){
+command_status fn_echo (inode_state& state, const token_list& words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
 
-   cout << word_range (words.cbegin() + 1, words.cend()) << endl;
+   state.out() << token_range (words.begin() + 1, words.end()) << endl;
+   return {};
 }
 
-void fn_exit (inode_state& state, const wordvec& words){
+command_status fn_exit (inode_state& state, const token_list& words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
 
    int exit_status = 0;
 
-   inode_ptr ptr = state.get_root();
-   state.set_cwd (ptr);
-   state.get_content (ptr) -> empty(ptr);
-
    if (words.size() > 1) {
       try {
-         exit_status = stoi (words.at(1));
+         exit_status = stoi (string (words.at(1)));
       } catch (...) {
          exit_status = 127;
       }
@@ -121,247 +263,674 @@ void fn_exit (inode_state& state, const wordvec& words){
    throw ysh_exit();
 }
 
-void fn_ls (inode_state& state, const wordvec& words){
+// append_pathname -
+//    Appends the pathname of the entry name in the directory whose
+//    pathname is dir_path.
+
+static void append_pathname (string& buffer, const string& dir_path,
+                             const string& name) {
+   buffer += dir_path;
+   if (dir_path.back() != '/') buffer += "/";
+   buffer += name;
+}
+
+// fn_find -
+//    Prints the pathname of every entry below each directory operand
+//    (or below the current directory if there are none), and of each
+//    plain file operand, whose name matches the pattern given with
+//    -name, or of all of them without one.  As with ls, directories
+//    have a "/" appended.  Entries are listed directory by directory,
+//    in the order lsr lists the directories, and the directories are
+//    scanned by print_dirs.
+
+command_status fn_find (inode_state& state, const token_list& words){
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+
+   vector<string_view> operands;
+   string_view name_pattern;
+   bool by_name = false;
+
+   for (auto itor = words.begin() + 1; itor != words.end(); ++itor) {
+      string_view word = *itor;
+      if (word == "-name") {
+         if (itor + 1 == words.end()) {
+            return {"find", word, "No pattern specified"};
+         }
+         name_pattern = *++itor;
+         by_name = true;
+      } else if (word.front() == '-') {
+         return {"find", word, "Unknown predicate"};
+      } else {
+         operands.push_back (word);
+      }
+   }
+
+   glob_pattern pattern (name_pattern);
+   vector<inode_ptr> tops;
+   string buffer;
+   for (string_view word: operands) {
+      inode_ptr ptr = state.pathname_to_inode_ptr (word);
+      if (ptr == nullptr) {
+         state.out() << buffer;
+         return {"find", word, "No such file or directory"};
+      }
+      if (ptr -> get_type() == file_type::DIRECTORY_TYPE) {
+         tops.push_back (ptr);
+      } else if (!by_name or pattern.matches
+                             (state.pathname_to_tokens (word).back())) {
+         buffer += word;
+         buffer += "\n";
+      }
+   }
+   if (operands.empty()) tops.push_back (state.get_cwd());
+
+   unordered_set<int> visited;
+   vector<inode_ptr> dirs;
+   collect_dirs (state, tops, visited, dirs);
+   print_dirs (state, dirs, buffer,
+      [&state, &pattern, by_name] (const inode_ptr& dir, string& out) {
+         const dirent_index& dirents =
+               state.get_content (dir) -> get_dirents();
+         string dir_path;
+         for (const auto& entry: dirents) {
+            const string& name = entry.first;
+            if (name == "." or name == "..") continue;
+            if (by_name and !pattern.matches (name)) continue;
+            if (dir_path.empty()) {
+               dir_path = state.get_tree().inode_ptr_to_pathname (dir);
+            }
+            append_pathname (out, dir_path, name);
+            if (entry.second -> get_type() == file_type::DIRECTORY_TYPE)
+               out += "/";
+            out += "\n";
+         }
+      });
+   return {};
+}
+
+// fn_grep -
+//    Prints the pathname and contents, separated by ":", of every
+//    plain file containing the pattern, which is a plain string, not
+//    a regular expression.  Plain file operands are searched, and
+//    every plain file below each directory operand (or below the
+//    current directory if there are none), in the order find lists
+//    them.  The directories are searched by print_dirs, with each
+//    file's contents scanned in place by contains.
+
+command_status fn_grep (inode_state& state, const token_list& words){
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+
+   if (words.size() == 1) {
+      return {"grep", {}, "No pattern specified"};
+   }
+   string_view pattern = words.at(1);
+   vector<inode_ptr> tops;
+   string buffer;
+
+   for (auto itor = words.begin() + 2; itor != words.end(); ++itor) {
+      string_view word = *itor;
+      inode_ptr ptr = state.pathname_to_inode_ptr (word);
+      if (ptr == nullptr) {
+         state.out() << buffer;
+         return {"grep", word, "No such file or directory"};
+      }
+      if (ptr -> get_type() == file_type::DIRECTORY_TYPE) {
+         tops.push_back (ptr);
+         continue;
+      }
+      const string& data = state.get_content (ptr) -> readfile();
+      if (contains (data, pattern)) {
+         buffer += word;
+         buffer += ":";
+         buffer += data;
+         buffer += "\n";
+      }
+   }
+   if (words.size() == 2) tops.push_back (state.get_cwd());
+
+   unordered_set<int> visited;
+   vector<inode_ptr> dirs;
+   collect_dirs (state, tops, visited, dirs);
+   print_dirs (state, dirs, buffer,
+      [&state, pattern] (const inode_ptr& dir, string& out) {
+         const dirent_index& dirents =
+               state.get_content (dir) -> get_dirents();
+         string dir_path;
+         for (const auto& entry: dirents) {
+            const inode_ptr& child = entry.second;
+            if (child -> get_type() != file_type::PLAIN_TYPE) continue;
+            const string& data =
+                  state.get_content (child) -> readfile();
+            if (!contains (data, pattern)) continue;
+            if (dir_path.empty()) {
+               dir_path = state.get_tree().inode_ptr_to_pathname (dir);
+            }
+            append_pathname (out, dir_path, entry.first);
+            out += ":";
+            out += data;
+            out += "\n";
+         }
+      });
+   return {};
+}
+
+// fn_ln -
+//    Links a plain file under a second name.  If the link name is a
+//    directory, the link goes in it under the last component of the
+//    target's name, as with ln(1).  Directories cannot be linked.
+
+command_status fn_ln (inode_state& state, const token_list& words){
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+
+   if (words.size() == 1) {
+      return {"ln", {}, "No target specified"};
+   } else if (words.size() == 2) {
+      return {"ln", {}, "No link name specified"};
+   } else if (words.size() > 3) {
+      return {"ln", {}, "More than one link name given"};
+   }
+   token_list target_path = state.pathname_to_tokens (words.at(1));
+   inode_ptr target = state.tokens_to_inode_ptr (target_path);
+   if (target == nullptr) {
+      return {"ln", words.at(1), "No such file or directory"};
+   }
+   if (target -> get_type() == file_type::DIRECTORY_TYPE) {
+      return {"ln", words.at(1), "Is a directory"};
+   }
+
+   token_list path = state.pathname_to_tokens (words.at(2));
+   inode_ptr ptr = state.tokens_to_inode_ptr (path);
+   string_view name;
+   if (ptr != nullptr
+       && ptr -> get_type() == file_type::DIRECTORY_TYPE) {
+      name = target_path.back();
+   } else {
+      name = path.back();
+      path.pop_back();
+      ptr = path.empty() ? state.get_cwd()
+                         : state.tokens_to_inode_ptr (path);
+      if (ptr == nullptr) {
+         return {"ln", words.at(2), "Pathname does not exist"};
+      }
+   }
+   result<> linked = state.get_content (ptr) -> link
+                     (state.get_table(), string (name), target);
+   if (!linked) return {"ln", words.at(2), linked.error()};
+   state.get_tree().record (journal_op::LINK, ptr, name, target);
+   return {};
+}
+
+command_status fn_ls (inode_state& state, const token_list& words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
 
    inode_ptr ptr = state.get_cwd();
+   string buffer;
 
    if (words.size() > 1) {
-      auto itor = ++words.cbegin();
-      string word;
+      vector<glob_match> matches;
+      auto itor = words.begin() + 1;
+      string_view word;
 
-      for (; itor != words.cend(); ++itor) {
+      for (; itor != words.end(); ++itor) {
          word = *itor;
-         ptr = state.pathname_to_inode_ptr (word);
-         if (ptr == nullptr) {
-            throw command_error ("ls: " + word 
-                                 + ": No such file or directory");
-            break;
+         command_status status =
+               expand_operand (state, "ls", word,
+                               "No such file or directory", matches);
+         if (!status) {
+            state.out() << buffer;
+            return status;
+         }
+         for (const glob_match& match: matches) {
+            if (match.ptr -> get_type() == file_type::PLAIN_TYPE)
+               format_file_ls (state, match.name, buffer);
+            else
+               format_dir_ls (state, match.ptr, buffer);
          }
-         if (ptr -> get_type() == file_type::PLAIN_TYPE)
-            print_file_ls (state, word);
-         else
-            print_dir_ls (state, ptr);
       }
-   } else print_dir_ls (state, ptr);
+   } else format_dir_ls (state, ptr, buffer);
+
+   state.out() << buffer;
+   return {};
 }
 
-void fn_lsr (inode_state& state, const wordvec& words){
+// fn_lsr -
+//    Prints the names of any plain file operands, then the current
+//    directory, then every directory below each directory operand
+//    (or below the current directory if there are none), each
+//    directory only once.  Operands are all resolved and the
+//    directories found before anything is listed, and then the
+//    listings are printed by print_dirs.
+
+command_status fn_lsr (inode_state& state, const token_list& words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
 
-   inode_ptr ptr = state.get_cwd();
-   vector<inode_ptr> all_directories;
-   all_directories.push_back (ptr);
-   
+   inode_ptr cwd = state.get_cwd();
+   vector<inode_ptr> tops;
+   string buffer;
+
    if (words.size() > 1) {
-      auto itor = ++words.cbegin();
-      string word;
+      auto itor = words.begin() + 1;
+      string_view word;
 
-      for (; itor != words.cend(); ++itor) {
+      for (; itor != words.end(); ++itor) {
          word = *itor;
-         ptr = state.pathname_to_inode_ptr (word);
+         inode_ptr ptr = state.pathname_to_inode_ptr (word);
          if (ptr == nullptr) {
-            throw command_error ("lsr: " + word 
-                                 + ": No such file or directory");
-            break;
+            state.out() << buffer;
+            return {"lsr", word, "No such file or directory"};
          }
          if (ptr -> get_type() == file_type::PLAIN_TYPE)
-            print_file_ls (state, word);
+            format_file_ls (state, word, buffer);
          else
-            all_directories = 
-               state.get_subdirectories (ptr, all_directories);
+            tops.push_back (ptr);
       }
-      ptr = state.pathname_to_inode_ptr (words.at(1));
-   } else {
-      all_directories = state.get_subdirectories (ptr, all_directories);
-      ptr = state.get_cwd();
+   } else tops.push_back (cwd);
+
+   unordered_set<int> visited {cwd -> get_inode_nr()};
+   vector<inode_ptr> dirs {cwd};
+   for (const inode_ptr& top: tops) {
+      state.get_tree().for_each_subdirectory (top, visited,
+         [&dirs] (const inode_ptr& dir) {
+            dirs.push_back (dir);
+         });
    }
 
+   print_dirs (state, dirs, buffer,
+      [&state] (const inode_ptr& dir, string& out) {
+         format_dir_ls (state, dir, out);
+      });
+   return {};
+}
+
+void format_file_ls (inode_state& state, string_view pathname,
+                     string& buffer) {
+   token_list path = state.pathname_to_tokens (pathname);
+
+   buffer += path.back();
+   buffer += "\n";
+}
 
-   //print_dir_ls (state, ptr);
-   for (inode_ptr temp_ptr: all_directories) {
-      print_dir_ls (state, temp_ptr);
+void format_dir_ls (inode_state& state, const inode_ptr& ptr,
+                    string& buffer) {
+   const dirent_index& dirents =
+         state.get_content (ptr) -> get_dirents();
+   char numbers[32];
+
+   buffer += state.get_tree().inode_ptr_to_pathname (ptr);
+   buffer += ":\n";
+
+   for (const auto& entry: dirents) {
+      const string& name = entry.first;
+      const inode_ptr& child = entry.second;
+      snprintf (numbers, sizeof numbers, "%6d%6d  ",
+                child -> get_inode_nr(), child -> get_size());
+      buffer += numbers;
+      buffer += name;
+      if (child -> get_type() == file_type::DIRECTORY_TYPE
+          && name != "." && name != "..") buffer += "/";
+      buffer += "\n";
    }
 }
 
-void print_file_ls (inode_state& state, string& pathname) {   
-   wordvec path = state.pathname_to_wordvec (pathname);
-   string file = path.at (path.size() - 1);
+void print_dirs (inode_state& state, const vector<inode_ptr>& dirs,
+                 string& buffer, const dir_format& format) {
+   constexpr size_t flush_size = 1 << 16;
+   constexpr size_t chunk_entries = 4096;
+   worker_pool* workers = state.get_workers();
+
+   if (workers == nullptr or workers -> size() == 1) {
+      for (const inode_ptr& dir: dirs) {
+         format (dir, buffer);
+         if (buffer.size() >= flush_size) {
+            state.out() << buffer;
+            buffer.clear();
+         }
+      }
+      state.out() << buffer;
+      buffer.clear();
+      return;
+   }
 
-   cout << file << endl;
+   state.out() << buffer;
+   buffer.clear();
+   size_t round_chunks = 4 * workers -> size();
+   vector<string> chunks (round_chunks);
+   // Chunk i of a round lists dirs[bounds[i]] to dirs[bounds[i+1]].
+   vector<size_t> bounds;
+   for (size_t first = 0; first < dirs.size(); first = bounds.back()) {
+      bounds.assign (1, first);
+      while (bounds.back() < dirs.size()
+             and bounds.size() <= round_chunks) {
+         size_t last = bounds.back();
+         size_t entries = 0;
+         while (last < dirs.size() and entries < chunk_entries) {
+            entries += dirs[last++] -> get_size();
+         }
+         bounds.push_back (last);
+      }
+      workers -> run (bounds.size() - 1,
+         [&format, &dirs, &bounds, &chunks] (size_t chunk) {
+            chunks[chunk].clear();
+            for (size_t dir = bounds[chunk]; dir < bounds[chunk + 1];
+                 ++dir) {
+               format (dirs[dir], chunks[chunk]);
+            }
+         });
+      for (size_t chunk = 0; chunk + 1 < bounds.size(); ++chunk) {
+         state.out() << chunks[chunk];
+      }
+   }
 }
 
-void print_dir_ls (inode_state& state, inode_ptr& ptr) {
-   wordvec content = state.get_content (ptr) -> get_dir_content();
-   
-   cout << state.inode_ptr_to_pathname (ptr) << ":" << endl;
+void collect_dirs (inode_state& state, const vector<inode_ptr>& tops,
+                   unordered_set<int>& visited,
+                   vector<inode_ptr>& dirs) {
+   for (const inode_ptr& top: tops) {
+      if (visited.insert (top -> get_inode_nr()).second) {
+         dirs.push_back (top);
+      }
+      state.get_tree().for_each_subdirectory (top, visited,
+         [&dirs] (const inode_ptr& dir) {
+            dirs.push_back (dir);
+         });
+   }
+}
+
+command_status fn_load (inode_state& state, const token_list& words){
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
 
-   for (size_t i = 0; i < content.size() - 2; i += 3) {
-      cout << setw(6) << content[i] << setw(6) << content.at (i + 1) 
-           << "  " << content.at (i + 2) << endl;
+   if (words.size() == 1) {
+      return {"load", {}, "No filename specified"};
+   } else if (words.size() > 2) {
+      return {"load", {}, "More than one operand given"};
    }
+   result<> loaded = state.get_tree().load_image (string (words.at(1)));
+   if (!loaded) return {"load", words.at(1), loaded.error()};
+   state.get_tree().record (journal_op::LOAD, nullptr, words.at(1),
+                            nullptr);
+   return {};
 }
 
-void fn_make (inode_state& state, const wordvec& words){
+command_status fn_make (inode_state& state, const token_list& words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
 
    if (words.size() <= 1) {
-      throw command_error ("make: No filename specified");
+      return {"make", {}, "No filename specified"};
    } else {
-      wordvec path = state.pathname_to_wordvec (words.at(1));
-      inode_ptr ptr = state.wordvec_to_inode_ptr (path);
+      token_list path = state.pathname_to_tokens (words.at(1));
+      inode_ptr ptr = state.tokens_to_inode_ptr (path);
 
       if (ptr != nullptr
           && ptr -> get_type() == file_type::DIRECTORY_TYPE) {
-         throw command_error ("make: " + words.at(1) 
-                              + ": Cannot specify a directory");
-         return;
+         return {"make", words.at(1), "Cannot specify a directory"};
       }
 
       string name;
       if (path.size() > 1) {
-         name = path.at (path.size() - 1);
+         name = path.back();
          path.pop_back();
-         ptr = state.wordvec_to_inode_ptr (path);
+         ptr = state.tokens_to_inode_ptr (path);
 
          if (ptr == nullptr) {
-            throw command_error ("make: " + words.at(1) 
-                                 + ": Pathname does not exist");
-            return;
+            return {"make", words.at(1), "Pathname does not exist"};
          }
       } else {
          name = path.at(0);
          ptr = state.get_cwd();
       }
 
-      ptr = state.get_content(ptr) -> mkfile(name);
+      result<inode_ptr> file =
+            state.get_content(ptr) -> mkfile(state.get_table(), name);
+      if (!file) return {"make", words.at(1), file.error()};
+      state.get_tree().record (journal_op::MKFILE, ptr, name,
+                               file.value());
+      ptr = file.value();
 
       if (words.size() > 2) {
+         state.get_table().preserve (ptr);
          state.get_content(ptr) -> writefile(words);
+         state.get_tree().record (journal_op::WRITE, nullptr, {}, ptr);
       }
 
    }
+   return {};
 }
 
-void fn_mkdir (inode_state& state, const wordvec& words){
+command_status fn_mkdir (inode_state& state, const token_list& words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
    
    if (words.size() == 1) 
-      throw command_error ("mkdir: No directory name specified");
+      return {"mkdir", {}, "No directory name specified"};
    else {
-      wordvec path = state.pathname_to_wordvec (words.at(1));
+      token_list path = state.pathname_to_tokens (words.at(1));
       inode_ptr ptr = state.get_cwd();
-      string name;
+      if (path.empty()) {
+         return {"mkdir", words.at(1),
+                 "File or directory already exists"};
+      }
+      string_view last = path.back();
       if (path.size() > 1) {
-         name = path.at (path.size() - 1);
          path.pop_back();
-         ptr = state.wordvec_to_inode_ptr (path);
+         ptr = state.tokens_to_inode_ptr (path);
          if (ptr == nullptr) {
-            throw command_error ("mkdir: " + words.at(1) 
-                                 + ": Pathname does not exist");
-            return;
+            return {"mkdir", words.at(1), "Pathname does not exist"};
          }
-      } else name = path.at(0);
+      }
    
-      state.get_content (ptr) -> mkdir (name);
+      base_file_ptr parent = state.get_content (ptr);
+      result<inode_ptr> dir = parent -> mkdir (state.get_table(),
+                                               string (last));
+      // An existing name is reported alone, a plain file on the way
+      // with the whole pathname.
+      if (!dir) {
+         return {"mkdir", ptr -> get_type() == file_type::PLAIN_TYPE
+                          ? words.at(1) : last, dir.error()};
+      }
+      state.get_tree().record (journal_op::MKDIR, ptr, last,
+                               dir.value());
    }
+   return {};
 }
 
-void fn_prompt (inode_state& state, const wordvec& words){
+command_status fn_prompt (inode_state& state, const token_list& words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
 
    string prompt = "";
-   auto itor = ++words.cbegin();
+   auto itor = words.begin() + 1;
 
    if (words.size() == 1) prompt = "% ";
    else {
-      for (; itor != words.cend(); ++itor){
-         prompt += *itor + " ";
+      for (; itor != words.end(); ++itor){
+         prompt += *itor;
+         prompt += " ";
       }
    }
    
    state.set_prompt (prompt);
+   return {};
+}
+
+command_status fn_pwd (inode_state& state, const token_list& words){
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+
+   file_tree& tree = state.get_tree();
+   state.out() << tree.inode_ptr_to_pathname (state.get_cwd()) << endl;
+   return {};
 }
 
-void fn_pwd (inode_state& state, const wordvec& words){
+command_status fn_restore (inode_state& state, const token_list& words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
 
-   cout << state.inode_ptr_to_pathname (state.get_cwd()) << endl;
+   if (words.size() == 1) {
+      return {"restore", {}, "No snapshot specified"};
+   } else if (words.size() > 2) {
+      return {"restore", {}, "More than one operand given"};
+   }
+   string name (words.at(1));
+   if (!state.get_table().restore_snapshot (name)) {
+      return {"restore", words.at(1), "No such snapshot"};
+   }
+   state.get_tree().record (journal_op::RESTORE, nullptr, name,
+                            nullptr);
+   return {};
 }
 
-void fn_rm (inode_state& state, const wordvec& words){
+command_status fn_rm (inode_state& state, const token_list& words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
 
    if (words.size() == 1) 
-      throw command_error ("rm: No file or directory specified");
+      return {"rm", {}, "No file or directory specified"};
    else {
-      auto itor = ++words.cbegin();
-      string word;
+      auto itor = words.begin() + 1;
    
       for (; itor != words.end(); ++itor){
-         word = *itor;
-         rm_r (state, word, false);
+         command_status status = rm_r (state, *itor, false);
+         if (!status) return status;
       }
    }
+   return {};
 }
 
-void fn_rmr (inode_state& state, const wordvec& words){
+command_status fn_rmr (inode_state& state, const token_list& words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
 
    if (words.size() == 1) 
-      throw command_error ("rmr: No file or directory specified");
+      return {"rmr", {}, "No file or directory specified"};
    else {
-      auto itor = ++words.cbegin();
-      string word;
+      auto itor = words.begin() + 1;
    
       for (; itor != words.end(); ++itor){
-         word = *itor;
-         rm_r (state, word, true);
+         command_status status = rm_r (state, *itor, true);
+         if (!status) return status;
       }
    }
+   return {};
 }
 
-void rm_r (inode_state& state, const string& pathname, bool recursive){
-   wordvec path = state.pathname_to_wordvec (pathname);
-   inode_ptr ptr = state.wordvec_to_inode_ptr (path);
-   string name = "";
+command_status fn_save (inode_state& state, const token_list& words){
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
 
-   if (ptr == state.get_root()) {
-      throw command_error ("rmr: Cannot remove root");
-      return;
+   if (words.size() == 1) {
+      return {"save", {}, "No filename specified"};
+   } else if (words.size() > 2) {
+      return {"save", {}, "More than one operand given"};
    }
+   result<> saved = state.get_tree().save_image (string (words.at(1)));
+   if (!saved) return {"save", words.at(1), saved.error()};
+   return {};
+}
 
-   if (ptr != nullptr) {
-      if (ptr -> get_type() == file_type::DIRECTORY_TYPE 
-          && ptr -> get_size() != 2 && !recursive) {
-         throw command_error ("rm: " + pathname 
-                               + ": Directory not empty");
-         return;
-      } else {
-         if (ptr -> get_type() == file_type::DIRECTORY_TYPE)
-            state.get_content (ptr) -> remove(ptr, name);
-         name = path.at (path.size() - 1);
-         path.pop_back();
-         if (!path.empty())
-            ptr = state.wordvec_to_inode_ptr (path);
-         else ptr = state.get_cwd();
-         state.get_content (ptr) -> remove(ptr, name);
+command_status fn_snapshot (inode_state& state,
+                            const token_list& words){
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+
+   if (words.size() == 1) {
+      return {"snapshot", {}, "No snapshot name specified"};
+   } else if (words.size() > 2) {
+      return {"snapshot", {}, "More than one operand given"};
+   }
+   string name (words.at(1));
+   if (!state.get_table().take_snapshot (name)) {
+      return {"snapshot", words.at(1), "Snapshot already exists"};
+   }
+   state.get_tree().record (journal_op::SNAPSHOT, nullptr, name,
+                            nullptr);
+   return {};
+}
+
+command_status fn_stats (inode_state& state, const token_list& words){
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+
+   const inode_table& table = state.get_table();
+   state.out() << "inodes: " << table.size()
+               << " in use, numbers up to "
+               << table.next_inode_nr() - 1 << endl;
+   state.get_dcache().print_stats (state.out());
+   return {};
+}
+
+// remove_entry -
+//    Removes the entry name, whose inode is ptr, from dir.  Removing
+//    "." or ".." would leave a directory without its own entries, so
+//    those are refused.  Failures name operand, the word given.
+
+static command_status remove_entry (inode_state& state,
+                                    string_view command,
+                                    string_view operand,
+                                    const inode_ptr& dir,
+                                    string_view name,
+                                    const inode_ptr& ptr,
+                                    bool recursive) {
+   if (ptr -> get_type() == file_type::DIRECTORY_TYPE 
+       && ptr -> get_size() != 2 && !recursive) {
+      return {"rm", operand, "Directory not empty"};
+   }
+   if (name == "." || name == "..") {
+      return {command, operand, "Cannot remove . or .."};
+   }
+   base_file_ptr contents = state.get_content (dir);
+   result<> removed = contents -> remove (state.get_table(), name);
+   if (!removed) return {command, operand, removed.error()};
+   state.get_tree().record (journal_op::REMOVE, dir, name, nullptr);
+   return {};
+}
+
+// rm_r -
+//    Removes the last component of pathname from the directory
+//    named by the rest of it, or every entry matching pathname, if
+//    it has wildcards and matches any.  Matches are removed in
+//    order, up to the first that cannot be.
+
+command_status rm_r (inode_state& state, string_view pathname,
+                     bool recursive){
+   string_view command = recursive ? "rmr" : "rm";
+
+   if (glob_pattern::has_wildcards (pathname)) {
+      vector<glob_match> matches;
+      state.glob (pathname, matches);
+      for (const glob_match& match: matches) {
+         command_status status = remove_entry (state, command,
+               pathname, match.dir, match.name, match.ptr, recursive);
+         if (!status) return status;
       }
-   } else throw command_error ((recursive ? "rmr: " : "rm: ") 
-                               + pathname 
-                               + ": No such file of directory");
+      if (!matches.empty()) return {};
+   }
+
+   token_list path = state.pathname_to_tokens (pathname);
+   inode_ptr ptr = state.tokens_to_inode_ptr (path);
+
+   if (ptr == state.get_root()) {
+      return {"rmr", {}, "Cannot remove root"};
+   }
+   if (ptr == nullptr) {
+      return {command, pathname, "No such file of directory"};
+   }
+   string_view name = path.back();
+   path.pop_back();
+   inode_ptr dir = path.empty() ? state.get_cwd()
+                                : state.tokens_to_inode_ptr (path);
+   return remove_entry (state, command, pathname, dir, name, ptr,
+                        recursive);
 }
 
 void terminate_program (inode_state& state) {
-   wordvec words;
+   token_list words;
    fn_exit (state, words);
 }
 
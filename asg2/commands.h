@@ -4,49 +4,120 @@
 #ifndef __COMMANDS_H__
 #define __COMMANDS_H__
 
-#include <unordered_map>
+#include <string>
+#include <string_view>
 using namespace std;
 
 #include "file_sys.h"
 #include "util.h"
 
+// command_status -
+//    What a command returns.  A command that fails returns the name
+//    it reports itself as, the operand at fault, if any, and a
+//    message, and run_command prints them on stderr as
+//    "name: operand: message" and sets the exit status to 1.  The
+//    parts are string literals and views into the command line, so
+//    failing costs neither an allocation nor an unwind.  A default
+//    status is success.
+
+struct command_status {
+   string_view name;
+   string_view operand;
+   const char* message {nullptr};
+   explicit operator bool() const { return message == nullptr; }
+};
+
+// report -
+//    Prints a failed status on stderr, as complain() would, and in
+//    a single write.
+
+void report (const command_status& status);
+
 // A couple of convenient usings to avoid verbosity.
 
-using command_fn = void (*)(inode_state& state, const wordvec& words);
-using command_hash = unordered_map<string,command_fn>;
+using command_fn = command_status (*)(inode_state& state,
+                                      const token_list& words);
 
-// command_error -
-//    Extend runtime_error for throwing exceptions related to this 
-//    program.
+// execution functions -
 
-class command_error: public runtime_error {
-   public: 
-      explicit command_error (const string& what);
+command_status fn_hash     (inode_state& state, const token_list&);
+command_status fn_cat      (inode_state& state, const token_list&);
+command_status fn_cd       (inode_state& state, const token_list&);
+command_status fn_diff     (inode_state& state, const token_list&);
+command_status fn_echo     (inode_state& state, const token_list&);
+command_status fn_exit     (inode_state& state, const token_list&);
+command_status fn_find     (inode_state& state, const token_list&);
+command_status fn_grep     (inode_state& state, const token_list&);
+command_status fn_ln       (inode_state& state, const token_list&);
+command_status fn_load     (inode_state& state, const token_list&);
+command_status fn_ls       (inode_state& state, const token_list&);
+command_status fn_lsr      (inode_state& state, const token_list&);
+command_status fn_make     (inode_state& state, const token_list&);
+command_status fn_mkdir    (inode_state& state, const token_list&);
+command_status fn_prompt   (inode_state& state, const token_list&);
+command_status fn_pwd      (inode_state& state, const token_list&);
+command_status fn_restore  (inode_state& state, const token_list&);
+command_status fn_rm       (inode_state& state, const token_list&);
+command_status fn_rmr      (inode_state& state, const token_list&);
+command_status fn_save     (inode_state& state, const token_list&);
+command_status fn_snapshot (inode_state& state, const token_list&);
+command_status fn_stats    (inode_state& state, const token_list&);
+
+// command_entry -
+//    A command's name and function, and the access to the shared
+//    tree it needs:  NONE for commands that touch only the session,
+//    READ for those that look at the tree, which hold it shared, and
+//    WRITE for those that change it, which hold it exclusively.
+
+enum class command_access {NONE, READ, WRITE};
+
+struct command_entry {
+   string_view name;
+   command_fn fn;
+   command_access access;
 };
 
-// execution functions -
+// find_command -
+//    Returns the entry for a command name, or nullptr if there is no
+//    such command.  The names are hashed into a table built at
+//    compile time with a hash function chosen to be perfect for
+//    them, so a lookup is one hash, one probe and one comparison.
 
-void fn_hash   (inode_state& state, const wordvec& words);
-void fn_cat    (inode_state& state, const wordvec& words);
-void fn_cd     (inode_state& state, const wordvec& words);
-void fn_echo   (inode_state& state, const wordvec& words);
-void fn_exit   (inode_state& state, const wordvec& words);
-void fn_ls     (inode_state& state, const wordvec& words);
-void fn_lsr    (inode_state& state, const wordvec& words);
-void fn_make   (inode_state& state, const wordvec& words);
-void fn_mkdir  (inode_state& state, const wordvec& words);
-void fn_prompt (inode_state& state, const wordvec& words);
-void fn_pwd    (inode_state& state, const wordvec& words);
-void fn_rm     (inode_state& state, const wordvec& words);
-void fn_rmr    (inode_state& state, const wordvec& words);
-
-command_fn find_command_fn (const string& command);
+const command_entry* find_command (string_view command);
 
 // helper functions -
-
-void print_file_ls (inode_state& state, string& pathname);
-void print_dir_ls (inode_state& state, inode_ptr& ptr);
-void rm_r (inode_state& state, const string& pathname, bool recursive);
+// format_file_ls, format_dir_ls -
+//    Append the output of ls for a plain file or a directory to a
+//    buffer, so listings can be written out in large blocks.
+// print_dirs -
+//    Prints what format appends to a buffer for each of a list of
+//    directories, in order, after whatever is in the buffer, which
+//    is left empty.  Given a pool of more than one thread, the list
+//    is cut into chunks of about the same number of entries, which
+//    the threads format into buffers of their own, a round of a few
+//    chunks per thread at a time.  The buffers are printed in the
+//    order of the chunks, so the output is the same as with one
+//    thread, and only one round of it is held in memory at once.
+//    format may be called on several threads at once, and must not
+//    change the tree.
+// collect_dirs -
+//    Appends to dirs each directory in tops and every directory
+//    below it, in the order lsr lists them, skipping those whose
+//    inode numbers are in visited, and adding the rest to it.
+
+using dir_format = function<void (const inode_ptr& dir, string&)>;
+
+void format_file_ls (inode_state& state, string_view pathname,
+                     string& buffer);
+void format_dir_ls (inode_state& state, const inode_ptr& ptr,
+                    string& buffer);
+void print_dirs (inode_state& state, const vector<inode_ptr>& dirs,
+                 string& buffer, const dir_format& format);
+void collect_dirs (inode_state& state, const vector<inode_ptr>& tops,
+                   unordered_set<int>& visited,
+                   vector<inode_ptr>& dirs);
+command_status rm_r (inode_state& state, string_view pathname,
+                     bool recursive);
 void terminate_program (inode_state& state);
 
 // exit_status_message -
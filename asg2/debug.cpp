@@ -3,7 +3,6 @@
 
 #include <climits>
 #include <iostream>
-#include <vector>
 
 using namespace std;
 
@@ -19,14 +18,6 @@ void debugflags::setflags (const string& initflags) {
    }
 }
 
-// getflag -
-//    Check to see if a certain flag is on.
-
-bool debugflags::getflag (char flag) {
-   // WARNING: Don't TRACE this function or the stack will blow up.
-   return flags.test (static_cast<unsigned char> (flag));
-}
-
 void debugflags::where (char flag, const char* file, int line,
                         const char* func) {
    cout << execname() << ": DEBUG(" << flag << ") "
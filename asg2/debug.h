@@ -17,7 +17,8 @@ using namespace std;
 //    string.  As a special case, '@', sets all flags.
 // getflag -
 //    Used by the DEBUGF macro to check to see if a flag has been set.
-//    Not to be called by user code.
+//    Not to be called by user code.  Defined inline so that a trace
+//    whose flag is off costs one load and a predicted branch.
 
 class debugflags {
    private:
@@ -25,7 +26,9 @@ class debugflags {
       static flagset flags;
    public:
       static void setflags (const string& optflags);
-      static bool getflag (char flag);
+      static bool getflag (char flag) {
+         return flags[static_cast<unsigned char> (flag)];
+      }
       static void where (char flag, const char* file, int line,
                          const char* func);
 };
@@ -38,6 +41,7 @@ class debugflags {
 //       DEBUGF ('u', "foo = " << foo);
 //    will print two words and a newline if flag 'u' is  on.
 //    Traces are preceded by filename, line number, and function.
+//    When compiled with -DNDEBUG, traces expand to nothing.
 
 #ifdef NDEBUG
 #define DEBUGF(FLAG,CODE) ;
@@ -1,17 +1,25 @@
 // $Id: file_sys.cpp,v 1.41 2016-01-31 23:43:09-08 - - $
 // Ana Carolina Alves - adalves
 
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <fstream>
 #include <iostream>
 #include <stdexcept>
 #include <unordered_map>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 using namespace std;
 
-#include "commands.h"
 #include "debug.h"
 #include "file_sys.h"
 
-int inode::next_inode_nr {1};
+int inode::next_path_generation {1};
 
 struct file_type_hash {
    size_t operator() (file_type type) const {
@@ -27,12 +35,356 @@ ostream& operator<< (ostream& out, file_type type) {
    return out << hash[type];
 }
 
-inode_state::inode_state() {
-   root = make_shared<inode>(file_type::DIRECTORY_TYPE);
-   get_content (root) -> make_root(root);
-   cwd = root;
-   DEBUGF ('i', "root = " << root -> get_name() << ", cwd = " << cwd
-          << ", prompt = \"" << get_prompt() << "\"");
+inode_ptr inode_table::make (file_type type) {
+   base_file_ptr contents = nullptr;
+   switch (type) {
+      case file_type::PLAIN_TYPE:
+         contents = plain_files.make();
+         break;
+      case file_type::DIRECTORY_TYPE:
+         contents = directories.make();
+         break;
+   }
+   int inode_nr;
+   if (free_nrs.empty()) inode_nr = next_nr++;
+   else {
+      inode_nr = free_nrs.top();
+      free_nrs.pop();
+   }
+   inode_ptr ptr = inodes.make (inode_nr, type, contents);
+   if (!snapshots.empty()) snapshots.back().made.insert (ptr);
+   return ptr;
+}
+
+void inode_table::destroy (inode_ptr ptr) {
+   base_file_ptr contents = ptr -> get_content();
+   switch (ptr -> get_type()) {
+      case file_type::PLAIN_TYPE:
+         plain_files.free (static_cast<plain_file*> (contents));
+         break;
+      case file_type::DIRECTORY_TYPE:
+         directories.free (static_cast<directory*> (contents));
+         break;
+   }
+   free_nrs.push (ptr -> get_inode_nr());
+   inodes.free (ptr);
+}
+
+void inode_table::set_inode_nrs (const vector<inode_ptr>& by_nr) {
+   free_nrs = {};
+   next_nr = max<size_t> (by_nr.size(), 1);
+   for (int nr = 1; nr < next_nr; ++nr) {
+      if (by_nr[nr] == nullptr) free_nrs.push (nr);
+   }
+}
+
+inode_ptr inode_table::get (inode_handle handle) const {
+   return inodes.get (handle);
+}
+
+inode_ptr inode_table::in_slot (inode_handle handle) const {
+   return inodes.in_slot (handle);
+}
+
+inode_handle inode_table::handle_of (const inode_ptr& ptr) const {
+   return inodes.handle_of (ptr);
+}
+
+size_t inode_table::size() const { return inodes.size(); }
+
+//
+// A plain file that keeps other links is not released, but its
+// handles are made stale, since cached lookups may have reached it
+// through the link that is gone.
+//
+bool inode_table::drop_link (inode_ptr dir, string_view name,
+                             inode_ptr ptr) {
+   if (ptr -> get_links() == 1) return false;
+   preserve (ptr);
+   ptr -> remove_link (dir, name);
+   inodes.invalidate (ptr);
+   return true;
+}
+
+//
+// The subtree is listed in level order, which needs no stack, as the
+// list itself is the queue of directories still to be read.  Every
+// inode comes after its directory, so releasing from the end of the
+// list releases the entries of a directory before the directory
+// itself.  The entries are read in the order they are stored, since
+// sorting them would be wasted.  A file linked more than once inside
+// the subtree loses a link each time it is reached, and is listed
+// only at its last.  An inode kept for a snapshot keeps its
+// contents, so restoring the snapshot needs only to relink it.
+//
+void inode_table::release (inode_ptr dir, string_view name,
+                           inode_ptr ptr) {
+   if (drop_link (dir, name, ptr)) return;
+   vector<inode_ptr> subtree {ptr};
+   for (size_t next = 0; next < subtree.size(); ++next) {
+      inode_ptr node = subtree[next];
+      if (node -> get_type() != file_type::DIRECTORY_TYPE) continue;
+      const directory* contents =
+            static_cast<const directory*> (node -> get_content());
+      for (const auto& entry: contents -> dirents.entries) {
+         if (entry.first != "." && entry.first != ".."
+             && !drop_link (node, entry.first, entry.second)) {
+            subtree.push_back (entry.second);
+         }
+      }
+   }
+   for (auto itor = subtree.crbegin(); itor != subtree.crend();
+        ++itor) {
+      inode_ptr node = *itor;
+      if (snapshots.empty() or snapshots.back().made.erase (node) > 0) {
+         destroy (node);
+      } else {
+         inodes.invalidate (node);
+         snapshots.back().released.push_back (node);
+      }
+   }
+}
+
+void inode_table::swap (inode_table& that) {
+   inodes.swap (that.inodes);
+   plain_files.swap (that.plain_files);
+   directories.swap (that.directories);
+   snapshots.swap (that.snapshots);
+   std::swap (next_nr, that.next_nr);
+   free_nrs.swap (that.free_nrs);
+}
+
+void inode_table::preserve (inode_ptr ptr) {
+   if (snapshots.empty()) return;
+   snapshot& newest = snapshots.back();
+   if (newest.made.count (ptr) > 0 or newest.saved.count (ptr) > 0) {
+      return;
+   }
+   saved_contents& copy = newest.saved[ptr];
+   base_file_ptr contents = ptr -> get_content();
+   switch (ptr -> get_type()) {
+      case file_type::PLAIN_TYPE:
+         copy.data = static_cast<plain_file*> (contents) -> data;
+         copy.parent = ptr -> parent;
+         copy.name = ptr -> name;
+         copy.more_links = ptr -> more_links;
+         break;
+      case file_type::DIRECTORY_TYPE:
+         copy.dirents = static_cast<directory*> (contents) -> dirents;
+         break;
+   }
+}
+
+vector<inode_table::snapshot>::iterator inode_table::find_snapshot
+                                        (const string& name) {
+   return find_if (snapshots.begin(), snapshots.end(),
+                   [&name] (const snapshot& snap) {
+                      return snap.name == name;
+                   });
+}
+
+bool inode_table::take_snapshot (const string& name) {
+   if (find_snapshot (name) != snapshots.end()) return false;
+   snapshots.emplace_back();
+   snapshots.back().name = name;
+   return true;
+}
+
+//
+// Within each log, contents are put back before inodes are
+// destroyed, since a log may hold the contents of an inode made
+// after an older snapshot.  Inodes released since the snapshot are
+// relinked by the contents of their directories, and need nothing
+// more.  A plain file linked under another name since then loses
+// that name but stays in the tree, so its handle is invalidated, as
+// lookups of the name may have been cached.
+//
+bool inode_table::restore_snapshot (const string& name) {
+   auto target = find_snapshot (name);
+   if (target == snapshots.end()) return false;
+
+   while (!snapshots.empty()) {
+      snapshot& newest = snapshots.back();
+      for (auto& entry: newest.saved) {
+         base_file_ptr contents = entry.first -> get_content();
+         switch (entry.first -> get_type()) {
+            case file_type::PLAIN_TYPE:
+               if (entry.first -> parent != entry.second.parent
+                   or entry.first -> name != entry.second.name
+                   or entry.first -> more_links
+                      != entry.second.more_links) {
+                  inodes.invalidate (entry.first);
+               }
+               static_cast<plain_file*> (contents) -> data
+                     = move (entry.second.data);
+               entry.first -> parent = entry.second.parent;
+               entry.first -> name = move (entry.second.name);
+               entry.first -> more_links
+                     = move (entry.second.more_links);
+               break;
+            case file_type::DIRECTORY_TYPE:
+               static_cast<directory*> (contents) -> dirents
+                     = move (entry.second.dirents);
+               break;
+         }
+      }
+      for (inode_ptr ptr: newest.made) destroy (ptr);
+      if (&newest == &*target) break;
+      snapshots.pop_back();
+   }
+   target -> saved.clear();
+   target -> made.clear();
+   target -> released.clear();
+   return true;
+}
+
+//
+// The oldest copy of an inode's contents in the logs since the
+// snapshot is what it held when the snapshot was taken.  Inodes made
+// or released since then are reported through their directories.
+//
+bool inode_table::snapshot_changes (const string& name,
+                                    vector<change>& changes) {
+   auto target = find_snapshot (name);
+   if (target == snapshots.end()) return false;
+
+   unordered_map<inode_ptr,const saved_contents*> before;
+   unordered_set<inode_ptr> gone;
+   for (auto snap = target; snap != snapshots.end(); ++snap) {
+      for (const auto& entry: snap -> saved) {
+         before.emplace (entry.first, &entry.second);
+      }
+      gone.insert (snap -> made.cbegin(), snap -> made.cend());
+      gone.insert (snap -> released.cbegin(), snap -> released.cend());
+   }
+
+   for (const auto& entry: before) {
+      inode_ptr ptr = entry.first;
+      if (gone.count (ptr) > 0) continue;
+      if (ptr -> get_type() == file_type::PLAIN_TYPE) {
+         if (entry.second -> data
+             != ptr -> get_content() -> readfile()) {
+            changes.push_back ({'M', nullptr, ptr, {}});
+         }
+         continue;
+      }
+      const dirent_index& old_dirents = entry.second -> dirents;
+      const dirent_index& new_dirents =
+            ptr -> get_content() -> get_dirents();
+      auto old_itor = old_dirents.begin();
+      auto new_itor = new_dirents.begin();
+      while (old_itor != old_dirents.end()
+             or new_itor != new_dirents.end()) {
+         if (new_itor == new_dirents.end()
+             or (old_itor != old_dirents.end()
+                 and old_itor -> first < new_itor -> first)) {
+            changes.push_back ({'D', ptr, old_itor -> second,
+                                old_itor -> first});
+            ++old_itor;
+         } else if (old_itor == old_dirents.end()
+                    or new_itor -> first < old_itor -> first) {
+            changes.push_back ({'A', ptr, new_itor -> second,
+                                new_itor -> first});
+            ++new_itor;
+         } else {
+            if (old_itor -> second != new_itor -> second) {
+               changes.push_back ({'D', ptr, old_itor -> second,
+                                   old_itor -> first});
+               changes.push_back ({'A', ptr, new_itor -> second,
+                                   new_itor -> first});
+            }
+            ++old_itor;
+            ++new_itor;
+         }
+      }
+   }
+   return true;
+}
+
+dentry_cache::dentry_cache (const inode_table& inodes):
+              inodes (inodes) {
+}
+
+inode_ptr dentry_cache::find (table& tab, inode_handle dir,
+                              string_view name) {
+   probe.dir = dir;
+   probe.name.assign (name.data(), name.size());
+   auto itor = tab.entries.find (probe);
+   if (itor == tab.entries.end()) {
+      ++tab.misses;
+      return nullptr;
+   }
+   inode_ptr ptr = inodes.get (itor -> second);
+   if (ptr == nullptr) {
+      tab.entries.erase (itor);
+      ++tab.misses;
+      return nullptr;
+   }
+   ++tab.hits;
+   return ptr;
+}
+
+void dentry_cache::insert (table& tab, inode_handle dir,
+                           string_view name, const inode_ptr& ptr) {
+   // Entries for freed inodes are only dropped lazily, so bound
+   // the size of the table by starting over when it gets too big.
+   if (tab.entries.size() >= MAX_ENTRIES) tab.entries.clear();
+   tab.entries.emplace (key {dir, string (name)},
+                        inodes.handle_of (ptr));
+}
+
+inode_ptr dentry_cache::find_name (inode_handle dir, string_view name) {
+   return find (names, dir, name);
+}
+
+void dentry_cache::insert_name (inode_handle dir, string_view name,
+                                const inode_ptr& ptr) {
+   insert (names, dir, name, ptr);
+}
+
+inode_ptr dentry_cache::find_path (inode_handle dir, string_view path) {
+   return find (paths, dir, path);
+}
+
+void dentry_cache::insert_path (inode_handle dir, string_view path,
+                                const inode_ptr& ptr) {
+   insert (paths, dir, path, ptr);
+}
+
+void dentry_cache::print_stats (ostream& out, const string& label,
+                                const table& tab) {
+   size_t lookups = tab.hits + tab.misses;
+   out << "dcache " << label << ": " << tab.entries.size()
+       << " entries, " << tab.hits << " hits, " << tab.misses
+       << " misses";
+   if (lookups > 0) {
+      out << ", " << tab.hits * 100 / lookups << "% hit rate";
+   }
+   out << endl;
+}
+
+void dentry_cache::clear() {
+   names.entries.clear();
+   paths.entries.clear();
+}
+
+void dentry_cache::print_stats (ostream& out) const {
+   print_stats (out, "names", names);
+   print_stats (out, "paths", paths);
+}
+
+file_tree::file_tree() {
+   root = table.make (file_type::DIRECTORY_TYPE);
+   root -> get_content() -> make_root (root);
+   DEBUGF ('i', "root = " << root -> get_name());
+}
+
+//
+// The tree is not touched here, as the caller need not hold it.  No
+// epoch matches, so the first call to get_cwd sets cwd to the root.
+//
+inode_state::inode_state (file_tree& tree): tree (tree) {
+   DEBUGF ('i', "prompt = \"" << get_prompt() << "\"");
 }
 
 const string& inode_state::get_prompt() { return prompt_; }
@@ -41,37 +393,54 @@ void inode_state::set_prompt (const string& new_prompt) {
    prompt_ = new_prompt;
 }
 
-base_file_ptr inode_state::get_content (inode_ptr ptr) {
+base_file_ptr inode_state::get_content (const inode_ptr& ptr) {
    return ptr -> get_content(); 
 }
 
-const inode_ptr inode_state::get_root() { return root; }
+inode_ptr inode_state::get_root() { return tree.get_root(); }
+
+//
+// After an image is loaded, cwd and the handles in the cache may
+// name inodes of the new tree that have nothing to do with them, so
+// both are dropped before anything is looked up.
+//
+inode_ptr inode_state::get_cwd() {
+   inode_table& table = tree.get_table();
+   if (epoch != tree.get_epoch()) {
+      epoch = tree.get_epoch();
+      dcache.clear();
+      cwd = {};
+   }
+   inode_ptr ptr = table.get (cwd);
+   if (ptr == nullptr) {
+      ptr = tree.get_root();
+      cwd = table.handle_of (ptr);
+   }
+   return ptr;
+}
+
+void inode_state::set_cwd (inode_ptr ptr) {
+   cwd = tree.get_table().handle_of (ptr);
+}
 
-const inode_ptr inode_state::get_cwd() {return cwd; }
+file_tree& inode_state::get_tree() { return tree; }
 
-void inode_state::set_cwd (inode_ptr ptr) { cwd = ptr; }
+inode_table& inode_state::get_table() { return tree.get_table(); }
 
 ostream& operator<< (ostream& out, const inode_state& state) {
-   out << "inode_state: root = " << state.root
-       << ", cwd = " << state.cwd;
+   out << "inode_state: root = " << state.tree.get_root()
+       << ", cwd = " << state.tree.get_table().get (state.cwd);
    return out;
 }
 
-inode_ptr inode_state::find_inode_ptr (const string& name, 
-                                            inode_ptr& curr) {
-   map<string,inode_ptr> dirents = get_content (curr) -> get_dirents();
-   inode_ptr ptr = nullptr;
-
-   if (dirents.find (name) != dirents.end()) {
-      ptr = dirents.find (name) -> second;
-   }
-
-   return ptr;
+inode_ptr inode_state::find_inode_ptr (string_view name,
+                                       const inode_ptr& curr) {
+   return get_content (curr) -> lookup (name);
 }
 
-wordvec inode_state::pathname_to_wordvec (const string& pathname) {
-   wordvec path;
-   string delimiter = "/";
+token_list inode_state::pathname_to_tokens (string_view pathname) {
+   token_list path;
+   string_view delimiter = "/";
    size_t begin = 0, end = 0;
 
    if (pathname.at(0) == '/') {
@@ -80,7 +449,7 @@ wordvec inode_state::pathname_to_wordvec (const string& pathname) {
    for (;;) {
       if (begin == pathname.size()) break;
       end = pathname.find_first_of(delimiter, begin);
-      if (end == string::npos) {
+      if (end == string_view::npos) {
          end = pathname.size();
          path.push_back (pathname.substr (begin, end - begin));
          DEBUGF ('i', "path " << path);
@@ -94,79 +463,549 @@ wordvec inode_state::pathname_to_wordvec (const string& pathname) {
    return path;
 }
 
-inode_ptr inode_state::wordvec_to_inode_ptr (const wordvec& pathname) {
-   inode_ptr ptr = cwd;
+inode_ptr inode_state::tokens_to_inode_ptr
+                     (const token_list& pathname) {
+   inode_ptr ptr = get_cwd();
 
    if (pathname.empty()) {
-      return root;
+      return tree.get_root();
    }
 
-   for (string path: pathname) {
-      ptr = find_inode_ptr (path, ptr);
-      if (ptr == nullptr) break;
+   for (string_view path: pathname) {
+      inode_handle dir = tree.get_table().handle_of (ptr);
+      inode_ptr next = dcache.find_name (dir, path);
+      if (next == nullptr) {
+         next = find_inode_ptr (path, ptr);
+         if (next == nullptr) return nullptr;
+         dcache.insert_name (dir, path, next);
+      }
+      ptr = next;
    }
 
    return ptr;
 }
 
-inode_ptr inode_state::pathname_to_inode_ptr (const string& pathname) {
-   return wordvec_to_inode_ptr (pathname_to_wordvec (pathname));
+inode_ptr inode_state::pathname_to_inode_ptr (string_view pathname) {
+   bool cacheable = pathname.find ("..") == string_view::npos;
+   inode_handle dir = tree.get_table().handle_of (get_cwd());
+
+   if (cacheable) {
+      inode_ptr cached = dcache.find_path (dir, pathname);
+      if (cached != nullptr) return cached;
+   }
+
+   token_list path = pathname_to_tokens (pathname);
+   inode_ptr ptr = tokens_to_inode_ptr (path);
+   if (cacheable and ptr != nullptr) {
+      dcache.insert_path (dir, pathname, ptr);
+   }
+
+   return ptr;
 }
 
-string inode_state::inode_ptr_to_pathname (const inode_ptr& ptr) {
-   inode_ptr temp = ptr;
-   wordvec path;
-   string pathname = "";
+//
+// The directories reached by the components so far are kept in
+// order, so the matches of the last component come out sorted.
+//
+void inode_state::glob (string_view pathname,
+                        vector<glob_match>& matches) {
+   token_list path = pathname_to_tokens (pathname);
+   vector<inode_ptr> dirs {pathname.front() == '/' ? tree.get_root()
+                                                   : get_cwd()};
+   matches.clear();
+   for (string_view component: path) {
+      if (!matches.empty()) {
+         dirs.clear();
+         for (const glob_match& match: matches) {
+            if (match.ptr -> get_type() == file_type::DIRECTORY_TYPE) {
+               dirs.push_back (match.ptr);
+            }
+         }
+         matches.clear();
+      }
+      if (!glob_pattern::has_wildcards (component)) {
+         for (const inode_ptr& dir: dirs) {
+            inode_ptr ptr = find_inode_ptr (component, dir);
+            if (ptr != nullptr) {
+               matches.push_back ({dir, string (component), ptr});
+            }
+         }
+      } else {
+         glob_pattern pattern (component);
+         for (const inode_ptr& dir: dirs) {
+            const dirent_index& dirents =
+                  get_content (dir) -> get_dirents();
+            for (const auto& entry: dirents) {
+               const string& name = entry.first;
+               if (name == "." or name == "..") continue;
+               if (pattern.matches (name)) {
+                  matches.push_back ({dir, name, entry.second});
+               }
+            }
+         }
+      }
+      if (matches.empty()) return;
+   }
+}
 
-   if (ptr != root) {
-      while (temp != root) {
-         path.push_back (temp -> get_name());
-         temp = find_inode_ptr ("..", temp);
+//
+// Climbs the parent links until reaching the root or a directory
+// whose cached path is still valid, then builds the pathname with a
+// single allocation.  The result is cached on directories, which
+// readers may do at once, hence path_lock.
+//
+string file_tree::inode_ptr_to_pathname (const inode_ptr& ptr) {
+   lock_guard<mutex> guard (path_lock);
+   int generation = inode::next_path_generation;
+   vector<inode*> chain;
+   size_t length = 0;
+   inode* node = ptr;
+   const string* prefix = nullptr;
+
+   for (; node != root; node = node -> parent) {
+      if (node -> path_generation == generation) {
+         prefix = &node -> path;
+         break;
+      }
+      chain.push_back (node);
+      length += node -> name.size() + 1;
+   }
+   if (chain.empty()) return prefix == nullptr ? "/" : *prefix;
+
+   string pathname;
+   if (prefix != nullptr) {
+      pathname.reserve (prefix -> size() + length);
+      pathname = *prefix;
+   } else pathname.reserve (length);
+   for (auto itor = chain.crbegin(); itor != chain.crend(); ++itor) {
+      pathname += "/";
+      pathname += (*itor) -> name;
+      if ((*itor) -> type == file_type::DIRECTORY_TYPE) {
+         (*itor) -> path = pathname;
+         (*itor) -> path_generation = generation;
       }
+   }
 
-      auto itor = path.crbegin();
+   return pathname;
+}
 
-      for (; itor != path.crend(); ++itor) {
-         pathname += "/" + *itor;
+void file_tree::for_each_subdirectory
+     (const inode_ptr& ptr, unordered_set<int>& visited,
+      const function<void (const inode_ptr&)>& visit) {
+   vector<inode_ptr> stack;
+
+   // Children are pushed in reverse so they are popped in order.
+   auto push_children = [&stack] (const inode_ptr& dir) {
+      const dirent_index& dirents =
+            dir -> get_content() -> get_dirents();
+      for (auto itor = dirents.rbegin(); itor != dirents.rend();
+           ++itor) {
+         if (itor -> second -> get_type() == file_type::DIRECTORY_TYPE
+             && itor -> first != "." && itor -> first != "..") {
+            stack.push_back (itor -> second);
+         }
       }
-   } else pathname = "/";
+   };
 
-   return pathname;
+   push_children (ptr);
+   while (!stack.empty()) {
+      inode_ptr dir = stack.back();
+      stack.pop_back();
+      if (!visited.insert (dir -> get_inode_nr()).second) continue;
+      DEBUGF ('i', "visit " << dir -> get_name());
+      visit (dir);
+      push_children (dir);
+   }
 }
 
-vector<inode_ptr> inode_state::get_subdirectories 
-                  (inode_ptr& ptr, vector<inode_ptr>& all_directories) {
-   map<string,inode_ptr> dirents = get_content (ptr) -> get_dirents();
-   auto dirents_itor = dirents.begin();
-   string name;
+const dentry_cache& inode_state::get_dcache() const { return dcache; }
 
-   for (; dirents_itor != dirents.end(); ++dirents_itor) {
-      ptr = dirents_itor -> second;
-      name = dirents_itor -> first;
-      if (ptr -> get_type() ==  
-          file_type::DIRECTORY_TYPE 
-          && name != ".."
-          && name != "."
-          && find (all_directories.begin(), all_directories.end(), ptr)
-                  == all_directories.end()) {
-         all_directories.push_back(ptr);
-         get_subdirectories (ptr, all_directories);
-         DEBUGF ('i', "all_directories " << name);
+result<wordvec> file_tree::diff_snapshot (const string& name) {
+   vector<inode_table::change> changes;
+   if (!table.snapshot_changes (name, changes)) {
+      return failure {"No such snapshot"};
+   }
+
+   vector<pair<string,char>> paths;
+   for (const auto& change: changes) {
+      string pathname;
+      if (change.dir == nullptr) {
+         pathname = inode_ptr_to_pathname (change.ptr);
+      } else {
+         pathname = inode_ptr_to_pathname (change.dir);
+         if (change.dir != root) pathname += "/";
+         pathname += change.name;
       }
+      if (change.ptr -> get_type() == file_type::DIRECTORY_TYPE) {
+         pathname += "/";
+      }
+      paths.emplace_back (pathname, change.kind);
+   }
+   // Stable, so an entry that was replaced is deleted, then added.
+   stable_sort (paths.begin(), paths.end(),
+                [] (const pair<string,char>& left,
+                    const pair<string,char>& right) {
+                   return left.first < right.first;
+                });
+
+   wordvec lines;
+   for (const auto& path: paths) {
+      lines.push_back (string (1, path.second) + " " + path.first);
    }
+   return lines;
+}
+
+const string image_magic = {'y', 's', 'h', 2};
+const uint64_t image_link_type = 2;
 
-   return all_directories;
+static uint64_t image_type (file_type type) {
+   return static_cast<uint64_t> (type);
 }
 
-inode::inode(file_type type): inode_nr (next_inode_nr++), type (type) {
-   switch (type) {
-      case file_type::PLAIN_TYPE:
-         contents = make_shared<plain_file>();
+static void put_image_int (string& image, uint64_t value, size_t size) {
+   for (size_t byte = 0; byte < size; ++byte) {
+      image += static_cast<char> (value >> (byte * 8));
+   }
+}
+
+struct image_reader {
+   const char* pos;
+   const char* end;
+   int version;
+   const char* take (uint64_t size) {
+      if (static_cast<uint64_t> (end - pos) < size) {
+         throw file_error ("truncated image");
+      }
+      const char* start = pos;
+      pos += size;
+      return start;
+   }
+   uint64_t get (size_t size) {
+      const char* bytes = take (size);
+      uint64_t value = 0;
+      for (size_t byte = 0; byte < size; ++byte) {
+         uint64_t bits = static_cast<unsigned char> (bytes[byte]);
+         value |= bits << (byte * 8);
+      }
+      return value;
+   }
+};
+
+result<> file_tree::save_image (const string& filename) {
+   string image = image_magic;
+   vector<pair<inode_ptr,const string*>> stack {{root, &root -> name}};
+   unordered_set<inode_ptr> linked;
+
+   put_image_int (image, table.next_inode_nr(), 4);
+   while (!stack.empty()) {
+      inode_ptr ptr = stack.back().first;
+      const string& name = *stack.back().second;
+      stack.pop_back();
+      bool link = ptr -> get_links() > 1
+                  and !linked.insert (ptr).second;
+      put_image_int (image, link ? image_link_type
+                                 : image_type (ptr -> get_type()), 1);
+      put_image_int (image, ptr -> get_inode_nr(), 4);
+      put_image_int (image, name.size(), 4);
+      image += name;
+      if (link) continue;
+      if (ptr -> get_type() == file_type::PLAIN_TYPE) {
+         const string& data = ptr -> get_content() -> readfile();
+         put_image_int (image, data.size(), 8);
+         image += data;
+         continue;
+      }
+      const dirent_index& dirents =
+            ptr -> get_content() -> get_dirents();
+      put_image_int (image, dirents.size() - 2, 4);
+      // Children are pushed in reverse so they are written in order.
+      for (auto itor = dirents.rbegin(); itor != dirents.rend();
+           ++itor) {
+         if (itor -> first != "." && itor -> first != "..") {
+            stack.emplace_back (itor -> second, &itor -> first);
+         }
+      }
+   }
+
+   ofstream out (filename, ios::binary);
+   if (not out) return failure {"cannot open"};
+   out.write (image.data(), image.size());
+   out.close();
+   if (not out) return failure {"write error"};
+   DEBUGF ('i', "saved " << image.size() << " bytes to " << filename);
+   return {};
+}
+
+//
+// Builds a new tree in a table from the records of an image.  Each
+// directory on the stack is paired with the number of its entries
+// still to be read.  The inodes are also listed by number, to check
+// that no number is used twice, to find the file a link record names,
+// and to free the numbers not used.  If the image is bad, whatever
+// was built is left in the table, to be freed with it.
+//
+inode_ptr file_tree::read_tree (image_reader& reader,
+                                  inode_table& into) {
+   struct pending {
+      inode_ptr dir;
+      uint64_t entries;
+   };
+   vector<pending> stack;
+   vector<inode_ptr> by_nr;
+   uint64_t next_inode_nr = reader.get (4);
+   auto number = [&] (uint64_t inode_nr, inode_ptr ptr) {
+      if (inode_nr == 0 or inode_nr >= next_inode_nr
+          or inode_nr > INT_MAX) {
+         throw file_error ("bad image");
+      }
+      if (inode_nr >= by_nr.size()) by_nr.resize (inode_nr + 1);
+      if (by_nr[inode_nr] != nullptr) throw file_error ("bad image");
+      by_nr[inode_nr] = ptr;
+      ptr -> inode_nr = inode_nr;
+   };
+   inode_ptr new_root = into.make (file_type::DIRECTORY_TYPE);
+   new_root -> get_content() -> make_root (new_root);
+
+   if (reader.get (1) != image_type (file_type::DIRECTORY_TYPE)) {
+         throw file_error ("bad image");
+      }
+   number (reader.get (4), new_root);
+   reader.take (reader.get (4));
+   stack.push_back ({new_root, reader.get (4)});
+   while (!stack.empty()) {
+      if (stack.back().entries == 0) {
+         stack.pop_back();
+         continue;
+      }
+      --stack.back().entries;
+      base_file_ptr dir = stack.back().dir -> get_content();
+      uint64_t type = reader.get (1);
+      uint64_t inode_nr = reader.get (4);
+      uint64_t length = reader.get (4);
+      string name (reader.take (length), length);
+      if (name.empty() || name == "." || name == ".."
+          || name.find ('/') != string::npos
+          || dir -> lookup (name) != nullptr) {
+         throw file_error ("bad image");
+      }
+      if (type == image_type (file_type::PLAIN_TYPE)) {
+         inode_ptr ptr = dir -> mkfile (into, name).value();
+         length = reader.get (8);
+         const char* data = reader.take (length);
+         ptr -> get_content() -> writefile (data, data + length);
+         number (inode_nr, ptr);
+      } else if (type == image_type (file_type::DIRECTORY_TYPE)) {
+         inode_ptr ptr = dir -> mkdir (into, name).value();
+         stack.push_back ({ptr, reader.get (4)});
+         number (inode_nr, ptr);
+      } else if (type == image_link_type and reader.version >= 2
+                 and inode_nr < by_nr.size()
+                 and by_nr[inode_nr] != nullptr
+                 and by_nr[inode_nr] -> type == file_type::PLAIN_TYPE) {
+         dir -> link (into, name, by_nr[inode_nr]).value();
+      } else throw file_error ("bad image");
+   }
+
+   into.set_inode_nrs (by_nr);
+   return new_root;
+}
+
+//
+// A bad image is found deep inside read_tree, so that is reported
+// by throwing file_error, which is turned into a failure here.
+//
+result<> file_tree::load_image (const string& filename) {
+   int fd = open (filename.c_str(), O_RDONLY);
+   if (fd < 0) return failure {"cannot open"};
+   struct stat info;
+   if (fstat (fd, &info) < 0) {
+      close (fd);
+      return failure {"cannot stat"};
+   }
+   size_t length = info.st_size;
+   if (length < image_magic.size()) {
+      close (fd);
+      return failure {"not a yshell image"};
+   }
+   void* map = mmap (nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+   close (fd);
+   if (map == MAP_FAILED) return failure {"cannot map"};
+   madvise (map, length, MADV_SEQUENTIAL);
+
+   const char* image = static_cast<const char*> (map);
+   inode_table loaded;
+   inode_ptr new_root;
+   try {
+      int version = image[image_magic.size() - 1];
+      if (image_magic.compare (0, image_magic.size() - 1, image,
+                               image_magic.size() - 1) != 0
+          or version < 1 or version > image_magic.back()) {
+         throw file_error ("not a yshell image");
+      }
+      image_reader reader {image + image_magic.size(), image + length,
+                           version};
+      new_root = read_tree (reader, loaded);
+      if (reader.pos != reader.end) throw file_error ("bad image");
+   }catch (file_error& error) {
+      munmap (map, length);
+      return failure {error.what()};
+   }catch (...) {
+      munmap (map, length);
+      throw;
+   }
+   munmap (map, length);
+
+   // The old tree, with any snapshots, goes when loaded does.
+   table.swap (loaded);
+   root = new_root;
+   ++epoch;
+   DEBUGF ('i', "loaded " << length << " bytes from " << filename);
+   return {};
+}
+
+void file_tree::record (journal_op op, const inode_ptr& dir,
+                        string_view name, const inode_ptr& ptr) {
+   if (log == nullptr) return;
+   record_buffer.clear();
+   put_image_int (record_buffer, static_cast<uint64_t> (op), 1);
+   put_image_int (record_buffer, dir == nullptr ? 0 : dir -> inode_nr,
+                  4);
+   put_image_int (record_buffer, ptr == nullptr ? 0 : ptr -> inode_nr,
+                  4);
+   put_image_int (record_buffer, name.size(), 4);
+   record_buffer += name;
+   if (op == journal_op::WRITE) {
+      const string& data = ptr -> get_content() -> readfile();
+      put_image_int (record_buffer, data.size(), 8);
+      record_buffer += data;
+   }
+   log -> append (record_buffer);
+}
+
+//
+// Lists the handle of every inode in the tree by number, for replay
+// to find the inodes records name.
+//
+void file_tree::index_inodes (vector<inode_handle>& by_nr) {
+   unordered_set<int> visited;
+   auto index = [this, &by_nr] (const inode_ptr& dir) {
+      for (const auto& entry: dir -> get_content() -> get_dirents()) {
+         by_nr[entry.second -> inode_nr] =
+               table.handle_of (entry.second);
+      }
+   };
+   by_nr.assign (table.next_inode_nr(), {});
+   index (root);
+   for_each_subdirectory (root, visited, index);
+}
+
+//
+// Makes the same calls the command that wrote the record did.  An
+// inode that is missing or of the wrong type, a call that fails, or
+// an inode made with another number than it had means the journal
+// was not written on this tree, which is reported by throwing
+// file_error, like a bad image.
+//
+result<> file_tree::replay (string_view record,
+                            vector<inode_handle>& by_nr) {
+   const char* mismatch = "journal does not match the tree";
+   image_reader reader {record.data(), record.data() + record.size(),
+                        image_magic.back()};
+   journal_op op = static_cast<journal_op> (reader.get (1));
+   uint64_t dir_nr = reader.get (4);
+   uint64_t ptr_nr = reader.get (4);
+   uint64_t length = reader.get (4);
+   string name (reader.take (length), length);
+   // A plain file that loses one of its links is given a new
+   // handle, but keeps its slot and number, which are enough to find
+   // it, since no two inodes in the table have the same number.
+   auto find = [&] (uint64_t inode_nr, file_type type) {
+      inode_ptr ptr = inode_nr < by_nr.size()
+                      ? table.in_slot (by_nr[inode_nr]) : nullptr;
+      if (ptr == nullptr
+          or static_cast<uint64_t> (ptr -> inode_nr) != inode_nr
+          or ptr -> type != type) {
+         throw file_error (mismatch);
+      }
+      return ptr;
+   };
+   auto made = [&] (const result<inode_ptr>& ptr) {
+      if (!ptr or static_cast<uint64_t> (ptr.value() -> inode_nr)
+                  != ptr_nr) {
+         throw file_error (mismatch);
+      }
+      if (ptr_nr >= by_nr.size()) by_nr.resize (ptr_nr + 1);
+      by_nr[ptr_nr] = table.handle_of (ptr.value());
+   };
+   const file_type directory_type = file_type::DIRECTORY_TYPE;
+   const file_type plain_type = file_type::PLAIN_TYPE;
+   bool done = true;
+
+   switch (op) {
+      case journal_op::MKDIR:
+         made (find (dir_nr, directory_type) -> get_content()
+               -> mkdir (table, name));
          break;
-      case file_type::DIRECTORY_TYPE:
-         contents = make_shared<directory>();
+      case journal_op::MKFILE:
+         made (find (dir_nr, directory_type) -> get_content()
+               -> mkfile (table, name));
+         break;
+      case journal_op::WRITE: {
+         inode_ptr ptr = find (ptr_nr, plain_type);
+         length = reader.get (8);
+         const char* data = reader.take (length);
+         table.preserve (ptr);
+         ptr -> get_content() -> writefile (data, data + length);
+         break;
+      }
+      case journal_op::REMOVE:
+         done = bool (find (dir_nr, directory_type) -> get_content()
+                      -> remove (table, name));
+         break;
+      case journal_op::LINK:
+         done = bool (find (dir_nr, directory_type) -> get_content()
+                      -> link (table, name, find (ptr_nr, plain_type)));
+         break;
+      case journal_op::SNAPSHOT:
+         done = table.take_snapshot (name);
+         break;
+      case journal_op::RESTORE:
+         done = table.restore_snapshot (name);
+         index_inodes (by_nr);
+         break;
+      case journal_op::LOAD: {
+         result<> loaded = load_image (name);
+         if (!loaded) return loaded;
+         index_inodes (by_nr);
          break;
+      }
+      default:
+         throw file_error ("bad journal");
    }
+   if (!done) throw file_error (mismatch);
+   if (reader.pos != reader.end) throw file_error ("bad journal");
+   return {};
+}
+
+result<size_t> file_tree::open_journal (journal& new_log,
+                                        const string& filename) {
+   vector<inode_handle> by_nr;
+   index_inodes (by_nr);
+   result<size_t> opened = new_log.open (filename,
+      [this, &by_nr] (string_view record) -> result<> {
+         try {
+            return replay (record, by_nr);
+         }catch (file_error& error) {
+            return failure {error.what()};
+         }
+      });
+   if (opened) log = &new_log;
+   DEBUGF ('i', "replayed " << opened.value() << " records");
+   return opened;
+}
+
+inode::inode (int inode_nr, file_type type, base_file_ptr contents):
+       inode_nr (inode_nr), type (type), contents (contents) {
    DEBUGF ('i', "inode " << inode_nr << ", type = " << type);
 }
 
@@ -178,6 +1017,7 @@ int inode::get_inode_nr() const {
 base_file_ptr inode::get_content() { return contents; }
 
 void inode::set_name (const string& new_name) {
+   if (!name.empty() && name != new_name) ++next_path_generation;
    name = new_name;
 }
 
@@ -191,91 +1031,299 @@ int inode::get_size() const {
 
 file_type inode::get_type() const { return type; }
 
-file_error::file_error (const string& what):
-            runtime_error (what) {
+void inode::set_parent (inode* new_parent) { parent = new_parent; }
+
+inode* inode::get_parent() const { return parent; }
+
+void inode::add_link (inode* dir, const string& link_name) {
+   more_links.emplace_back (dir, link_name);
 }
 
-size_t plain_file::size() const {
-   size_t size {0};
-   for (string word: data) {
-      size += word.size();
+//
+// Assigning the name directly, not by set_name, leaves the cached
+// paths of directories alone, as a plain file is never part of one.
+//
+void inode::remove_link (inode* dir, string_view link_name) {
+   if (dir == parent and link_name == name) {
+      if (more_links.empty()) return;
+      parent = more_links.back().first;
+      name = move (more_links.back().second);
+      more_links.pop_back();
+      return;
    }
-   if (size >= 1) size += data.size() - 1;
-   DEBUGF ('i', "size = " << size);
-   return size;
+   for (auto itor = more_links.begin(); itor != more_links.end();
+        ++itor) {
+      if (itor -> first == dir and itor -> second == link_name) {
+         *itor = move (more_links.back());
+         more_links.pop_back();
+         return;
+      }
+   }
+}
+
+int inode::get_links() const { return more_links.size() + 1; }
+
+file_error::file_error (const char* what): message (what) {
+}
+
+const char* file_error::what() const noexcept {
+   return message;
+}
+
+size_t plain_file::size() const {
+   DEBUGF ('i', "size = " << data.size());
+   return data.size();
 }
 
-const wordvec& plain_file::readfile() const {
+const string& plain_file::readfile() const {
    DEBUGF ('i', data);
    return data;
 }
 
-void plain_file::writefile (const wordvec& words) {
+//
+// The words are joined with single spaces, which is how cat prints
+// them, so the length of the buffer is the size of the file.
+//
+result<> plain_file::writefile (const token_list& words) {
    DEBUGF ('i', words);
+   size_t length = 0;
+   for (auto itor = words.begin() + 2; itor != words.end(); ++itor) {
+      length += itor -> size() + 1;
+   }
    data.clear();
-   data.insert (data.end(), words.begin() + 2, words.end());
+   data.reserve (length);
+   for (auto itor = words.begin() + 2; itor != words.end(); ++itor) {
+      if (!data.empty()) data += ' ';
+      data += *itor;
+   }
+   return {};
 }
 
-void plain_file::remove (inode_ptr&, string&) {
-   throw file_error ("is a plain file");
+result<> plain_file::writefile (const char* first, const char* last) {
+   data.assign (first, last);
+   return {};
+}
+
+result<> plain_file::remove (inode_table&, string_view) {
+   return failure {"Not a directory"};
 }
 
 wordvec plain_file::get_dir_content () {
    throw file_error ("is a plain file");
 }
 
-inode_ptr plain_file::mkdir (const string&) {
-   throw file_error ("is a plain file");
+result<inode_ptr> plain_file::mkdir (inode_table&, const string&) {
+   return failure {"Not a directory"};
 }
 
-inode_ptr plain_file::mkfile (const string&) {
-   throw file_error ("is a plain file");
+result<inode_ptr> plain_file::mkfile (inode_table&, const string&) {
+   return failure {"Not a directory"};
+}
+
+result<> plain_file::link (inode_table&, const string&, inode_ptr) {
+   return failure {"Not a directory"};
 }
 
 void plain_file::make_root (const inode_ptr) {
    throw file_error ("is a plain file");
 }
 
-map<string,inode_ptr> plain_file::get_dirents() const {
+const dirent_index& plain_file::get_dirents() const {
    throw file_error ("is a plain file");
 }
 
-void plain_file::empty(inode_ptr&) {
-   throw file_error ("is a plain file");
+inode_ptr plain_file::lookup (string_view) const {
+   return nullptr;
 }
 
 void plain_file::insert_dirents (const inode_ptr&, const inode_ptr&) {
    throw file_error ("is a plain file");
 }
 
+dirent_index::const_iterator dirent_index::search
+                             (string_view name) const {
+   return lower_bound (entries.cbegin(), entries.cend(), name,
+          [] (const value_type& entry, string_view key) {
+             return string_view (entry.first) < key;
+          });
+}
+
+mutex dirent_index::sort_lock;
+
+dirent_index::dirent_index (const dirent_index& that):
+              entries (that.entries), positions (that.positions),
+              sorted (that.sorted.load()) {
+}
+
+dirent_index& dirent_index::operator= (const dirent_index& that) {
+   entries = that.entries;
+   positions = that.positions;
+   sorted = that.sorted.load();
+   return *this;
+}
+
+dirent_index& dirent_index::operator= (dirent_index&& that) {
+   entries = move (that.entries);
+   positions = move (that.positions);
+   sorted = that.sorted.load();
+   return *this;
+}
+
+unordered_map<string,size_t>::iterator dirent_index::locate
+                                       (string_view name) const {
+   thread_local string probe;
+   probe.assign (name.data(), name.size());
+   return positions.find (probe);
+}
+
+//
+// Writers hold the tree exclusively, so once sorted is seen to be
+// true, nothing changes the entries until every reader is done.
+//
+void dirent_index::sort() const {
+   if (sorted.load (memory_order_acquire)) return;
+   lock_guard<mutex> guard (sort_lock);
+   if (sorted.load (memory_order_relaxed)) return;
+   std::sort (entries.begin(), entries.end(),
+              [] (const value_type& left, const value_type& right) {
+                 return left.first < right.first;
+              });
+   if (hashed()) reindex();
+   sorted.store (true, memory_order_release);
+}
+
+void dirent_index::reindex() const {
+   positions.clear();
+   positions.reserve (entries.size());
+   for (size_t pos = 0; pos < entries.size(); ++pos) {
+      positions.emplace (entries[pos].first, pos);
+   }
+}
+
+inode_ptr dirent_index::find_hashed (string_view name) const {
+   auto itor = locate (name);
+   if (itor == positions.end()) return nullptr;
+   return entries[itor -> second].second;
+}
+
+//
+// Only a hashed index is ever unsorted, and positions may be being
+// rebuilt by a sort in another thread, so whether it is hashed is
+// not asked until the entries are known to be sorted.
+//
+inode_ptr dirent_index::find (string_view name) const {
+   if (!sorted.load (memory_order_acquire)) {
+      lock_guard<mutex> guard (sort_lock);
+      return find_hashed (name);
+   }
+   if (hashed()) return find_hashed (name);
+   auto itor = search (name);
+   if (itor == entries.cend() or itor -> first != name) return nullptr;
+   return itor -> second;
+}
+
+bool dirent_index::insert (const string& name, inode_ptr ptr) {
+   if (hashed()) {
+      if (!positions.emplace (name, entries.size()).second) {
+         return false;
+      }
+      entries.emplace_back (name, ptr);
+      sorted = false;
+      return true;
+   }
+   auto itor = search (name);
+   if (itor != entries.cend() and itor -> first == name) return false;
+   entries.emplace (itor, name, ptr);
+   if (entries.size() > HASH_THRESHOLD) reindex();
+   return true;
+}
+
+void dirent_index::erase (string_view name) {
+   if (hashed()) {
+      auto itor = locate (name);
+      if (itor == positions.end()) return;
+      size_t pos = itor -> second;
+      positions.erase (itor);
+      if (pos != entries.size() - 1) {
+         entries[pos] = move (entries.back());
+         positions[entries[pos].first] = pos;
+         sorted = false;
+      }
+      entries.pop_back();
+      if (entries.size() <= HASH_THRESHOLD / 2) {
+         positions.clear();
+         sort();
+      }
+      return;
+   }
+   auto itor = search (name);
+   if (itor != entries.cend() and itor -> first == name) {
+      entries.erase (itor);
+   }
+}
+
+void dirent_index::clear() {
+   entries.clear();
+   positions.clear();
+   sorted = true;
+}
+
+dirent_index::const_iterator dirent_index::begin() const {
+   sort();
+   return entries.cbegin();
+}
+
+dirent_index::const_iterator dirent_index::end() const {
+   sort();
+   return entries.cend();
+}
+
+dirent_index::const_reverse_iterator dirent_index::rbegin() const {
+   sort();
+   return entries.crbegin();
+}
+
+dirent_index::const_reverse_iterator dirent_index::rend() const {
+   sort();
+   return entries.crend();
+}
+
 size_t directory::size() const {
    size_t size = dirents.size();
    DEBUGF ('i', "size = " << size);
    return size;
 }
 
-const wordvec& directory::readfile() const {
+const string& directory::readfile() const {
    throw file_error ("is a directory");
 }
 
-void directory::writefile (const wordvec&) {
-   throw file_error ("is a directory");
+result<> directory::writefile (const token_list&) {
+   return failure {"Is a directory"};
 }
 
-void directory::remove (inode_ptr& ptr, string& name) {
-   if (!name.empty()) {
-      dirents.erase (dirents.find (name));
-   } else empty (ptr);
+result<> directory::writefile (const char*, const char*) {
+   return failure {"Is a directory"};
+}
+
+result<> directory::remove (inode_table& table, string_view name) {
+   inode_ptr ptr = dirents.find (name);
+   if (ptr == nullptr) return failure {"No such file or directory"};
+   inode_ptr self = dirents.find (".");
+   table.preserve (self);
+   dirents.erase (name);
+   table.release (self, name, ptr);
+   return {};
 }
 
 wordvec directory::get_dir_content () {
    inode_ptr ptr;
    wordvec content;
    string name;
-   auto itor = dirents.cbegin();
+   auto itor = dirents.begin();
 
    
-   for (; itor != dirents.cend(); ++itor) {
+   for (; itor != dirents.end(); ++itor) {
       name = itor -> first;
       ptr = itor -> second;
       content.push_back (to_string (ptr -> get_inode_nr()));
@@ -285,84 +1333,85 @@ wordvec directory::get_dir_content () {
          content.push_back (itor -> first);
       } else {
          if (ptr -> get_type() ==  file_type::DIRECTORY_TYPE) {
-            content.push_back (ptr -> get_name() + "/");
+            content.push_back (name + "/");
          }
          else
-            content.push_back (ptr -> get_name());
+            content.push_back (name);
       }
    }
 
    return content;
 }
 
-inode_ptr directory::mkdir (const string& pathname) {
+result<inode_ptr> directory::mkdir (inode_table& table,
+                                    const string& pathname) {
    DEBUGF ('i', pathname);
 
    inode_ptr ptr;
-   if (dirents.find (pathname) == dirents.end()) {
-      ptr = make_shared<inode>(file_type::DIRECTORY_TYPE);
-      inode_ptr parent = dirents.at (".");
+   if (dirents.find (pathname) == nullptr) {
+      inode_ptr parent = dirents.find (".");
+      table.preserve (parent);
+      ptr = table.make (file_type::DIRECTORY_TYPE);
       inode_ptr child = ptr;
       base_file_ptr dir_ptr = ptr -> get_content();
       dir_ptr -> insert_dirents (parent, child);
-      dirents.insert (make_pair (pathname, ptr));
+      dirents.insert (pathname, ptr);
       ptr -> set_name (pathname);
+      ptr -> set_parent (parent);
       return ptr;
    } else {
-      throw command_error ("mkdir: " + pathname
-                           + ": File or directory already exists");
+      return failure {"File or directory already exists"};
    }
-
-   return ptr;
 }
 
-inode_ptr directory::mkfile (const string& pathname) {
+result<inode_ptr> directory::mkfile (inode_table& table,
+                                     const string& pathname) {
    DEBUGF ('i', pathname);
 
-   inode_ptr ptr;
-   if (dirents.find (pathname) == dirents.end()) {
-      ptr = make_shared<inode>(file_type::PLAIN_TYPE);
+   inode_ptr ptr = dirents.find (pathname);
+   if (ptr == nullptr) {
+      table.preserve (dirents.find ("."));
+      ptr = table.make (file_type::PLAIN_TYPE);
       ptr -> set_name (pathname);
-      dirents.insert (make_pair (pathname, ptr));
-   } else {
-      ptr = dirents.find (pathname) -> second;
+      ptr -> set_parent (dirents.find ("."));
+      dirents.insert (pathname, ptr);
    }
 
    return ptr;
 }
 
+result<> directory::link (inode_table& table, const string& name,
+                          inode_ptr target) {
+   DEBUGF ('i', name);
+
+   if (dirents.find (name) != nullptr) {
+      return failure {"File or directory already exists"};
+   }
+   inode_ptr self = dirents.find (".");
+   table.preserve (self);
+   table.preserve (target);
+   dirents.insert (name, target);
+   target -> add_link (self, name);
+   return {};
+}
+
 void directory::make_root (const inode_ptr root_ptr) {
-   dirents.insert (make_pair (".", root_ptr));
-   dirents.insert (make_pair ("..", root_ptr));
+   dirents.insert (".", root_ptr);
+   dirents.insert ("..", root_ptr);
    root_ptr -> set_name("/");
+   root_ptr -> set_parent (root_ptr);
 }
 
 void directory::insert_dirents 
      (const inode_ptr& parent, const inode_ptr& child) {
-   dirents.insert (make_pair (".", child));
-   dirents.insert (make_pair ("..", parent));
+   dirents.insert (".", child);
+   dirents.insert ("..", parent);
 }
 
-map<string,inode_ptr> directory::get_dirents() const {
+const dirent_index& directory::get_dirents() const {
    return dirents;
 }
 
-void directory::empty (inode_ptr& ptr) {
-   auto dirents_itor = dirents.begin();
-   base_file_ptr dir_ptr = ptr -> get_content();
-   string name;
-
-   for (; dirents_itor != dirents.end(); ++dirents_itor) {
-      name = dirents_itor -> first;
-      ptr = dirents_itor -> second;
-      dir_ptr = ptr -> get_content();
-      if (name != ".." && name != ".") {
-         if (ptr -> get_type() ==  file_type::DIRECTORY_TYPE) {
-            dir_ptr -> empty(ptr);
-         }
-      }
-   }
-
-   dirents.clear();
+inode_ptr directory::lookup (string_view name) const {
+   return dirents.find (name);
 }
-
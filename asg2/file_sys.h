@@ -6,13 +6,20 @@
 
 #include <exception>
 #include <algorithm>
+#include <atomic>
+#include <functional>
 #include <iostream>
 #include <iomanip>
 #include <memory>
-#include <map>
+#include <mutex>
+#include <queue>
+#include <shared_mutex>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 using namespace std;
 
+#include "slab.h"
 #include "util.h"
 
 // inode_t -
@@ -23,51 +30,19 @@ class inode;
 class base_file;
 class plain_file;
 class directory;
-using inode_ptr = shared_ptr<inode>;
-using base_file_ptr = shared_ptr<base_file>;
+class inode_table;
+using inode_ptr = inode*;
+using base_file_ptr = base_file*;
 ostream& operator<< (ostream&, file_type);
 
-// inode_state -
-//    A small convenient class to maintain the state of the simulated
-//    process:  the root (/), the current directory (.), and the
-//    prompt.
-// getters and setters -
-//    for prompt, contents (base_file_ptr in inode), root and cwd
-
-class inode_state {
-   friend class inode;
-   friend ostream& operator<< (ostream& out, const inode_state&);
-   private:
-      inode_state (const inode_state&) = delete; // copy ctor
-      inode_state& operator= (const inode_state&) = delete; // op=
-      inode_ptr root {nullptr};
-      inode_ptr cwd {nullptr};
-      string prompt_ {"% "};
-   public:
-      inode_state();
-      const string& get_prompt();
-      void set_prompt (const string&);
-      base_file_ptr get_content (inode_ptr);
-      const inode_ptr get_root();
-      const inode_ptr get_cwd();
-      void set_cwd (inode_ptr);
-      // Helper functions
-      inode_ptr find_inode_ptr (const string&, inode_ptr&);
-      wordvec pathname_to_wordvec (const string&);
-      inode_ptr wordvec_to_inode_ptr (const wordvec&);
-      inode_ptr pathname_to_inode_ptr (const string&);
-      string inode_ptr_to_pathname (const inode_ptr&);
-      vector<inode_ptr> get_subdirectories 
-                           (inode_ptr&, vector<inode_ptr>&);
-};
-
 // class inode -
 // inode ctor -
-//    Create a new inode of the given type, 
-//    and stores the number and type.
+//    Create a new inode of the given type,
+//    and stores the number, type and contents.
 // get_inode_nr -
 //    Retrieves the serial number of the inode.  Inode numbers are
-//    allocated in sequence by small integer.
+//    small integers handed out by the inode_table, which reuses
+//    those of inodes destroyed, smallest first.
 // size -
 //    Returns the size of an inode.  For a directory, this is the
 //    number of dirents.  For a text file, the number of characters
@@ -75,35 +50,136 @@ class inode_state {
 //    number of words.
 // getters and setters -
 //    for number, contents, name, size and type
+// set_parent, get_parent -
+//    A link to the directory containing the inode.  The root is its
+//    own parent.
+// add_link, remove_link, get_links -
+//    A plain file may have more than one name.  The first is held in
+//    name and parent, and any others in more_links, so the link count
+//    is one more than its size.  When the first link is removed, the
+//    last of the others takes its place.  Directories have one link.
+// path, path_generation -
+//    The full pathname of a directory, cached by
+//    file_tree::inode_ptr_to_pathname.  It is valid only while
+//    path_generation matches next_path_generation, which set_name
+//    advances whenever an inode that already has a name is renamed.
 
 class inode {
-   friend class inode_state;
+   friend class file_tree;
+   friend class inode_table;
    private:
-      static int next_inode_nr;
       int inode_nr;
       file_type type;
       string name;
       base_file_ptr contents;
+      inode* parent {nullptr};
+      vector<pair<inode*,string>> more_links;
+      string path;
+      int path_generation {0};
+      static int next_path_generation;
    public:
-      inode (file_type);
+      inode (int inode_nr, file_type, base_file_ptr);
       int get_inode_nr() const;
       base_file_ptr get_content();
       void set_name (const string&);
       const string& get_name () const;
       int get_size() const;
       file_type get_type() const;
+      void set_parent (inode*);
+      inode* get_parent() const;
+      void add_link (inode* dir, const string& link_name);
+      void remove_link (inode* dir, string_view link_name);
+      int get_links() const;
 };
 
-// class base_file -
-// Just a base class at which an inode can point.  No data or
-// functions.  Makes the synthesized members useable only from
-// the derived classes.
+// dirent_index -
+//    The entries of a directory, always iterated in lexicographic
+//    order.  A small directory is a flat vector kept sorted, so a
+//    lookup is a binary search over contiguous memory.  Once it
+//    grows past HASH_THRESHOLD entries, a hash table from names to
+//    positions in the vector is added.  New entries are then
+//    appended and removed ones replaced by the last, and the vector
+//    is sorted again only when it is next iterated.  The hash table
+//    is dropped again if the directory shrinks to half that size.
+//    Sessions reading the tree at once may both find it unsorted,
+//    so sorting is done under sort_lock, which is shared by every
+//    directory, as sorts are rare.  Until the entries are sorted,
+//    lookups take the lock too, and after that they need none.
+// find -
+//    Returns the inode of the named entry, or nullptr.  The hash
+//    table is keyed by string, so a name is copied into a probe
+//    string, one per thread, reused from one lookup to the next, to
+//    look it up.
+// insert -
+//    Adds an entry, unless one with that name already exists.
+//    Returns whether it was added.
+// erase -
+//    Removes the named entry, if there is one.
+// begin, end, rbegin, rend -
+//    Iterate over the entries as pairs of name and inode.  Any
+//    change to the directory invalidates the iterators.
+
+class dirent_index {
+   public:
+      using value_type = pair<string,inode_ptr>;
+      using entry_vector = vector<value_type>;
+      using const_iterator = entry_vector::const_iterator;
+      using const_reverse_iterator =
+            entry_vector::const_reverse_iterator;
+   private:
+      friend class inode_table;
+      static constexpr size_t HASH_THRESHOLD = 256;
+      mutable entry_vector entries;
+      mutable unordered_map<string,size_t> positions;
+      mutable atomic<bool> sorted {true};
+      static mutex sort_lock;
+      bool hashed() const { return !positions.empty(); }
+      const_iterator search (string_view name) const;
+      unordered_map<string,size_t>::iterator
+            locate (string_view name) const;
+      inode_ptr find_hashed (string_view name) const;
+      void sort() const;
+      void reindex() const;
+   public:
+      dirent_index() = default;
+      dirent_index (const dirent_index& that);
+      dirent_index& operator= (const dirent_index& that);
+      dirent_index& operator= (dirent_index&& that);
+      size_t size() const { return entries.size(); }
+      inode_ptr find (string_view name) const;
+      bool insert (const string& name, inode_ptr ptr);
+      void erase (string_view name);
+      void clear();
+      const_iterator begin() const;
+      const_iterator end() const;
+      const_reverse_iterator rbegin() const;
+      const_reverse_iterator rend() const;
+};
 
-class file_error: public runtime_error {
+// file_error -
+//    Thrown for errors that are not routine:  a bad or unreadable
+//    image, or asking a file for something only the other type has,
+//    such as the entries of a plain file.  Commands check the type
+//    first, so that never happens in response to user input.  The
+//    message must be a string literal, so what() remains valid after
+//    the exception is gone.
+
+class file_error: public exception {
+   private:
+      const char* message;
    public:
-      explicit file_error (const string& what);
+      explicit file_error (const char* what);
+      virtual const char* what() const noexcept override;
 };
 
+// class base_file -
+// Just a base class at which an inode can point.  No data or
+// functions.  Makes the synthesized members useable only from
+// the derived classes.  The operations that can be asked of either
+// type of file with a name that comes from the user (writefile,
+// remove, mkdir, mkfile, link) return a result, failing for the wrong
+// type with "Is a directory" or "Not a directory".
+
 class base_file {
    protected:
       base_file() = default;
@@ -114,47 +190,69 @@ class base_file {
    public:
       virtual ~base_file() = default;
       virtual size_t size() const = 0;
-      virtual const wordvec& readfile() const = 0;
-      virtual void writefile (const wordvec& newdata) = 0;
-      virtual void remove (inode_ptr& ptr, string& name) = 0;
+      virtual const string& readfile() const = 0;
+      virtual result<> writefile (const token_list& newdata) = 0;
+      virtual result<> writefile (const char* first,
+                                  const char* last) = 0;
+      virtual result<> remove (inode_table& table,
+                               string_view name) = 0;
       virtual wordvec get_dir_content() = 0;
-      virtual inode_ptr mkdir (const string& dirname) = 0;
-      virtual inode_ptr mkfile (const string& filename) = 0;
+      virtual result<inode_ptr> mkdir (inode_table& table,
+                                       const string& dirname) = 0;
+      virtual result<inode_ptr> mkfile (inode_table& table,
+                                        const string& filename) = 0;
+      virtual result<> link (inode_table& table, const string& name,
+                             inode_ptr target) = 0;
       virtual void make_root (inode_ptr root_ptr) = 0;
-      virtual map<string,inode_ptr> get_dirents() const = 0;
-      virtual void empty(inode_ptr&) = 0;
-      virtual void insert_dirents 
+      virtual const dirent_index& get_dirents() const = 0;
+      virtual inode_ptr lookup (string_view) const = 0;
+      virtual void insert_dirents
                    (const inode_ptr&, const inode_ptr&) = 0;
 };
 
 // class plain_file -
 // Used to hold data.
 // If errors are not commented here, they're checked in commands.cpp.
+// data -
+//    The words of the file, separated by single spaces, in one
+//    contiguous buffer.
 // synthesized default ctor -
-//    Default vector<string> is a an empty vector.
-// size - 
-//    Return the size of the file
-//    (Quantity of characters in each string + vector.size() - 1;
+//    Default string is an empty file.
+// size -
+//    Return the size of the file, which is the length of the buffer.
 // readfile -
-//    Returns a copy of the contents of the wordvec in the file.
+//    Returns a reference to the contents of the file, so it can be
+//    printed without copying.
+// lookup -
+//    A plain file has no entries, so always returns nullptr.
 // writefile -
-//    Replaces the contents of a file with new contents.
+//    Replaces the contents of a file with new contents, given either
+//    as the words of a make command or as the bytes of a buffer that
+//    is already in the joined form.
 
 class plain_file: public base_file {
+   friend class inode_table;
    private:
-      wordvec data;
+      string data;
    public:
       virtual size_t size() const override;
-      virtual const wordvec& readfile() const override;
-      virtual void writefile (const wordvec& newdata) override;
-      virtual void remove (inode_ptr& ptr, string& name) override;
+      virtual const string& readfile() const override;
+      virtual result<> writefile (const token_list& newdata) override;
+      virtual result<> writefile (const char* first,
+                                  const char* last) override;
+      virtual result<> remove (inode_table& table,
+                               string_view name) override;
       virtual wordvec get_dir_content() override;
-      virtual inode_ptr mkdir (const string& dirname) override;
-      virtual inode_ptr mkfile (const string& filename) override;
+      virtual result<inode_ptr> mkdir (inode_table& table,
+                                       const string& dirname) override;
+      virtual result<inode_ptr> mkfile
+              (inode_table& table, const string& filename) override;
+      virtual result<> link (inode_table& table, const string& name,
+                             inode_ptr target) override;
       virtual void make_root (inode_ptr root_ptr) override;
-      virtual map<string,inode_ptr> get_dirents() const override;
-      virtual void empty(inode_ptr&) override;
-      virtual void insert_dirents 
+      virtual const dirent_index& get_dirents() const override;
+      virtual inode_ptr lookup (string_view) const override;
+      virtual void insert_dirents
                    (const inode_ptr&, const inode_ptr&) override;
 };
 
@@ -162,52 +260,419 @@ class plain_file: public base_file {
 // Used to map filenames onto inode pointers.
 // If errors are not commented here, they're checked in commands.cpp.
 // dirents -
-//    Map that contains all pointers to all files and directories
-//    inside this directory.
-// size - 
+//    Index that contains all pointers to all files and directories
+//    inside this directory, in lexicographic order for printing.
+// size -
 //    Returns the size of the directory
 //    (quantity of files/directories inside).
 // remove -
-//    Calls the empty() method to remove file/directory.
-//    If called to remove a directory, sets up the pointer to the 
-//    parent directory so that empty() will erase everything inside 
-//    the directory and the directory itself.
-// get_dir_content - 
-//    Returns a wordvec with the contents of a directory 
+//    Removes the named entry and releases it, along with everything
+//    below it, to the table.  A plain file with other links only
+//    loses this one.
+// get_dir_content -
+//    Returns a wordvec with the contents of a directory
 //    (inode number, size, name - in this order).
 // mkdir -
-//    Creates a new directory under the current directory and 
-//    immediately calls insert_dirents() to add the directories 
-//    dot (.) and dotdot (..) to it. Error if directory already exists.
+//    Creates a new directory under the current directory and
+//    immediately calls insert_dirents() to add the directories
+//    dot (.) and dotdot (..) to it.  Fails if the name already
+//    exists.
 // mkfile -
-//    Create a new empty text file with the given name.
+//    Create a new empty text file with the given name, or return the
+//    one that exists.
+// link -
+//    Adds an entry with the given name for an existing plain file,
+//    which then has one more link.  Fails if the name already exists.
 // make_root -
 //    Sets up the root directory.
-// insert_dirents - 
+// insert_dirents -
 //    Sets up the "." and ".." in a new directory.
-// get_dirents - 
-//    Getter method for the dirents map.
-// empty - 
-//    Completely removes a file or directory (as well as
-//    everything inside).
+// get_dirents -
+//    Getter method for the dirents index.  Returns a reference, so
+//    callers can iterate without copying the index.
+// lookup -
+//    Resolves a name in place, returning the entry's inode, or
+//    nullptr if there is no such entry.
 
 class directory: public base_file {
+   friend class inode_table;
    private:
-      // Must be a map, not unordered_map, so printing is lexicographic
-      map<string,inode_ptr> dirents;
+      dirent_index dirents;
    public:
       virtual size_t size() const override;
-      virtual const wordvec& readfile() const override;
-      virtual void writefile (const wordvec& newdata) override;
-      virtual void remove (inode_ptr& ptr, string& name) override;
+      virtual const string& readfile() const override;
+      virtual result<> writefile (const token_list& newdata) override;
+      virtual result<> writefile (const char* first,
+                                  const char* last) override;
+      virtual result<> remove (inode_table& table,
+                               string_view name) override;
       virtual wordvec get_dir_content() override;
-      virtual inode_ptr mkdir (const string& dirname) override;
-      virtual inode_ptr mkfile (const string& filename) override;
+      virtual result<inode_ptr> mkdir (inode_table& table,
+                                       const string& dirname) override;
+      virtual result<inode_ptr> mkfile
+              (inode_table& table, const string& filename) override;
+      virtual result<> link (inode_table& table, const string& name,
+                             inode_ptr target) override;
       virtual void make_root (inode_ptr root_ptr) override;
-      virtual void insert_dirents 
+      virtual void insert_dirents
                    (const inode_ptr&, const inode_ptr&) override;
-      virtual map<string,inode_ptr> get_dirents() const override;
-      virtual void empty(inode_ptr&) override;
+      virtual const dirent_index& get_dirents() const override;
+      virtual inode_ptr lookup (string_view) const override;
+};
+
+// inode_table -
+//    The backing store for every inode and its contents.  Inodes,
+//    plain files and directories each come from their own slab, so
+//    creating a file is two bump allocations and nothing is
+//    reference counted.  Dirents, parent links and the like are
+//    plain pointers into the slabs, and the whole tree is released
+//    at once when the table is destroyed.  That is a single sweep
+//    over the chunks of each slab, which frees them whole.
+// make -
+//    Allocates an inode of the given type along with empty contents,
+//    and gives it the smallest inode number not in use, so numbers
+//    stay dense however many files come and go.
+// release -
+//    Drops the link to an inode from dir under name, which the caller
+//    has already erased, and returns the inode and everything below
+//    it to the table, without recursion, so the depth of the tree is
+//    not limited by the call stack.  A plain file with links outside
+//    the subtree only loses the links inside it, and is kept.
+//    Anything that may outlive the inode should hold a handle, not a
+//    pointer.
+// next_inode_nr, set_inode_nrs -
+//    The number above every inode number in use.  set_inode_nrs is
+//    for inodes that were given numbers of their own, such as those
+//    read from an image.  by_nr lists the inodes by number, and those
+//    missing become free to reuse.
+// swap -
+//    Exchanges the contents of two tables, so a whole tree can be
+//    built aside and then put in place, and the old one freed by
+//    destroying the other table.  Handles are not exchanged.
+// get, handle_of -
+//    Convert between inode pointers and handles.  get returns
+//    nullptr for a handle whose inode has been released.
+// in_slot -
+//    The inode in the slot a handle names, stale or not, which is
+//    the inode the handle was taken from only if it has the same
+//    number.
+//
+// Snapshots are undo logs.  Taking one only starts a new, empty
+// log.  The first time the contents of an inode are changed after
+// that, preserve must be called to copy them into the log, and any
+// inode made is recorded there too.  An inode released while there
+// are snapshots is not destroyed, since restoring may link it into
+// the tree again, but its handles still become stale.  Inodes made
+// since the newest snapshot are destroyed at once, as no snapshot
+// can refer to them.
+// preserve -
+//    Must be called before changing the contents of an inode, or the
+//    links of a plain file.
+// take_snapshot -
+//    Starts a snapshot with the given name.  Returns false if one
+//    already exists.
+// restore_snapshot -
+//    Puts back the contents of every inode changed since the named
+//    snapshot, newest log first, and destroys the inodes made since.
+//    Later snapshots are discarded.  The named one is kept, so it
+//    can be restored again.  Returns false if there is none.
+// snapshot_changes -
+//    Lists the entries added to or removed from directories, and the
+//    plain files modified, since the named snapshot.  This only
+//    looks at the logs, so it costs time in proportion to the
+//    changes, not to the size of the tree.  Returns false if there
+//    is no such snapshot.
+
+using inode_handle = slab<inode>::handle;
+
+class inode_table {
+   public:
+      struct change {
+         char kind;          // 'A'dded, 'D'eleted, or 'M'odified
+         inode_ptr dir;      // the directory, for 'A' and 'D'
+         inode_ptr ptr;      // the inode added, deleted or modified
+         string name;        // the name in dir, for 'A' and 'D'
+      };
+   private:
+      struct saved_contents {
+         dirent_index dirents;
+         string data;
+         inode_ptr parent;
+         string name;
+         vector<pair<inode*,string>> more_links;
+      };
+      struct snapshot {
+         string name;
+         unordered_map<inode_ptr,saved_contents> saved;
+         unordered_set<inode_ptr> made;
+         vector<inode_ptr> released;
+      };
+      slab<inode> inodes;
+      slab<plain_file> plain_files;
+      slab<directory> directories;
+      vector<snapshot> snapshots;
+      int next_nr {1};
+      priority_queue<int,vector<int>,greater<int>> free_nrs;
+      void destroy (inode_ptr ptr);
+      bool drop_link (inode_ptr dir, string_view name, inode_ptr ptr);
+      vector<snapshot>::iterator find_snapshot (const string& name);
+   public:
+      inode_ptr make (file_type type);
+      void release (inode_ptr dir, string_view name, inode_ptr ptr);
+      void swap (inode_table& that);
+      int next_inode_nr() const { return next_nr; }
+      void set_inode_nrs (const vector<inode_ptr>& by_nr);
+      inode_ptr get (inode_handle handle) const;
+      inode_ptr in_slot (inode_handle handle) const;
+      inode_handle handle_of (const inode_ptr& ptr) const;
+      size_t size() const;
+      void preserve (inode_ptr ptr);
+      bool take_snapshot (const string& name);
+      bool restore_snapshot (const string& name);
+      bool snapshot_changes (const string& name,
+                             vector<change>& changes);
+};
+
+// dentry_cache -
+//    Remembers the results of path resolution, keyed by the handle
+//    of the directory the lookup started from, rather than its inode
+//    number, which may be reused, and either a single name or a whole
+//    pathname.  Only successful lookups are cached, so
+//    creating files or directories (make, mkdir) never makes an entry
+//    wrong.  Entries hold handles into the inode_table, so removing
+//    files or directories (rm, rmr) invalidates exactly the entries
+//    that resolve to them; such entries are dropped the next time
+//    they are found.  Pathnames containing ".." are not cached, since
+//    removing a directory they pass through would not free the inode
+//    they resolve to.
+// find_name, find_path -
+//    Return the cached inode, or nullptr on a miss.  The name is
+//    copied into a probe key that is reused from one lookup to the
+//    next, so a lookup does not allocate memory once the probe has
+//    grown to the longest name seen.
+// clear -
+//    Drops every entry, but keeps the statistics.
+// print_stats -
+//    Prints hits, misses, and hit rate for each table.
+
+class dentry_cache {
+   private:
+      struct key {
+         inode_handle dir;
+         string name;
+         bool operator== (const key& that) const {
+            return dir.index == that.dir.index
+               and dir.generation == that.dir.generation
+               and name == that.name;
+         }
+      };
+      struct key_hash {
+         size_t operator() (const key& that) const {
+            return hash<string>() (that.name) * 31 + that.dir.index;
+         }
+      };
+      struct table {
+         unordered_map<key,inode_handle,key_hash> entries;
+         size_t hits {0};
+         size_t misses {0};
+      };
+      static constexpr size_t MAX_ENTRIES = 1 << 16;
+      const inode_table& inodes;
+      table names;
+      table paths;
+      key probe;
+      inode_ptr find (table&, inode_handle, string_view);
+      void insert (table&, inode_handle, string_view, const inode_ptr&);
+      static void print_stats (ostream&, const string&, const table&);
+   public:
+      explicit dentry_cache (const inode_table& inodes);
+      inode_ptr find_name (inode_handle dir, string_view name);
+      void insert_name (inode_handle dir, string_view name,
+                        const inode_ptr& ptr);
+      inode_ptr find_path (inode_handle dir, string_view path);
+      void insert_path (inode_handle dir, string_view path,
+                        const inode_ptr& ptr);
+      void clear();
+      void print_stats (ostream&) const;
+};
+
+// file_tree -
+//    The tree shared by every session:  the inode_table and the
+//    root.  Commands that only read the tree hold access shared, and
+//    those that change it hold it exclusively, so any number of
+//    sessions may read at once while writes are serialized.  A
+//    reader changes nothing another reader can see, except what is
+//    built lazily, the order of dirents and the pathnames cached on
+//    directories, and each of those has a lock of its own.
+// get_root, get_table -
+//    The root directory, and the inode_table, for commands that
+//    create or remove files.
+// get_access -
+//    The reader-writer lock described above.
+// get_epoch -
+//    The number of images loaded.  Loading reuses the table, so a
+//    handle taken before that may name an inode of the new tree; a
+//    session whose epoch is behind drops its handles.
+// inode_ptr_to_pathname -
+//    The full pathname of an inode.
+// diff_snapshot -
+//    Lists what has changed since the named snapshot, one line per
+//    change:  "A" or "D" and the pathname of an entry added to or
+//    deleted from a directory, or "M" and the pathname of a plain
+//    file whose contents were modified.  Directories have a "/"
+//    appended, and the lines are in order of pathname.  Fails if
+//    there is no such snapshot.
+// save_image, load_image -
+//    Write the whole tree to a file, or replace the tree with one
+//    read from a file, which is mapped into memory rather than read.
+//    Inode numbers are preserved, and after loading the root is the
+//    current directory.  The image is a magic number "ysh" and a
+//    version byte, the next inode number, and then a record for each
+//    entry in preorder:  type, inode number, name, and either the
+//    contents of the file or the number of entries in the directory,
+//    not counting "." and "..".  A plain file is written in full only
+//    at its first link, and each later one is a link record, with
+//    type 2 and no contents.  Version 1 images, which have no links,
+//    are still read.  All integers are little-endian, and lengths
+//    precede strings.  Errors are returned as failures, and the tree
+//    is left unchanged if an image cannot be loaded.  Loading an
+//    image discards all snapshots.  The new tree is built in a table
+//    of its own, which then replaces the old table.
+// for_each_subdirectory -
+//    Calls visit on every directory below ptr, in preorder and in
+//    lexicographic order within each directory.  Directories whose
+//    inode numbers are already in visited are skipped along with
+//    their subtrees, and each directory visited is added to it.  The
+//    traversal uses an explicit stack, so depth is not limited by
+//    the call stack.  The tree must not be modified by visit.
+// open_journal, record -
+//    Once a journal is open, every change made to the tree by a
+//    command is recorded in it, so that a session that crashed can be
+//    recovered by opening the journal again on the tree it started
+//    from, which is empty, or the image it loaded with -l.  Opening
+//    first replays the records already there, and then the journal
+//    takes new ones.  Commands call record after each change
+//    succeeds, while holding the tree exclusively, so the records
+//    are in the order the changes were made.  A record names inodes
+//    by number, which replay maps straight to inodes rather than
+//    resolving any pathname, and as replay makes the same calls the
+//    commands did, new inodes get the same numbers, which is
+//    checked.  A record is the op, a byte, the inode numbers of dir
+//    and ptr, or 0, and name, and for WRITE the contents of ptr.
+//    MKDIR and MKFILE give the inode made as ptr, and LINK the target
+//    as ptr.  REMOVE needs only dir and name, and SNAPSHOT, RESTORE
+//    and LOAD only name.  A file named by LOAD must still hold the
+//    same image when the journal is replayed.
+
+enum class journal_op {MKDIR = 1, MKFILE, WRITE, REMOVE, LINK,
+                       SNAPSHOT, RESTORE, LOAD};
+
+struct image_reader;
+
+class file_tree {
+   private:
+      file_tree (const file_tree&) = delete;
+      file_tree& operator= (const file_tree&) = delete;
+      inode_table table;
+      inode_ptr root {nullptr};
+      int epoch {0};
+      shared_mutex access;
+      mutex path_lock;
+      journal* log {nullptr};
+      string record_buffer;
+      inode_ptr read_tree (image_reader& reader, inode_table& into);
+      void index_inodes (vector<inode_handle>& by_nr);
+      result<> replay (string_view record,
+                       vector<inode_handle>& by_nr);
+   public:
+      file_tree();
+      inode_ptr get_root() { return root; }
+      inode_table& get_table() { return table; }
+      shared_mutex& get_access() { return access; }
+      int get_epoch() const { return epoch; }
+      string inode_ptr_to_pathname (const inode_ptr&);
+      void for_each_subdirectory
+           (const inode_ptr& ptr, unordered_set<int>& visited,
+            const function<void (const inode_ptr&)>& visit);
+      result<wordvec> diff_snapshot (const string& name);
+      result<> save_image (const string& filename);
+      result<> load_image (const string& filename);
+      result<size_t> open_journal (journal& log,
+                                   const string& filename);
+      void record (journal_op op, const inode_ptr& dir,
+                   string_view name, const inode_ptr& ptr);
+};
+
+// inode_state -
+//    A small convenient class to maintain the state of the simulated
+//    process:  the current directory (.), the prompt, a cache of
+//    lookups and where output goes.  Each session has one, and many
+//    may share one file_tree.
+// getters and setters -
+//    for prompt, contents (base_file_ptr in inode), root and cwd
+// get_cwd -
+//    The current directory is held by handle.  If it has been
+//    removed, the root becomes the current directory, as it does
+//    when an image has been loaded since it was set.
+// get_tree, get_table -
+//    The shared tree, and its inode_table.
+// out, set_out -
+//    The stream commands write their output to, cout by default.
+// get_workers, set_workers -
+//    The pool of threads that lsr may format listings with, if any.
+// pathname_to_tokens -
+//    Splits a pathname into its components.  The tokens are views
+//    into the pathname, which must outlive them.
+// glob -
+//    Expands a pathname with wildcards in any of its components into
+//    the entries that match it, in lexicographic order.  Each
+//    component with wildcards is compiled into a glob_pattern once,
+//    and matched against every entry of each directory reached so
+//    far, while the others are looked up by name, so the cost is
+//    linear in the number of entries scanned.  "." and ".." are
+//    never matched by a pattern.  A match is the directory holding
+//    an entry, the name of the entry and its inode.  Every match is
+//    at the same depth, so none can be inside another.
+
+struct glob_match {
+   inode_ptr dir;
+   string name;
+   inode_ptr ptr;
+};
+
+class inode_state {
+   friend ostream& operator<< (ostream& out, const inode_state&);
+   private:
+      inode_state (const inode_state&) = delete; // copy ctor
+      inode_state& operator= (const inode_state&) = delete; // op=
+      file_tree& tree;
+      dentry_cache dcache {tree.get_table()};
+      inode_handle cwd;
+      int epoch {-1};
+      string prompt_ {"% "};
+      ostream* output {&cout};
+      worker_pool* workers {nullptr};
+   public:
+      explicit inode_state (file_tree& tree);
+      const string& get_prompt();
+      void set_prompt (const string&);
+      base_file_ptr get_content (const inode_ptr&);
+      inode_ptr get_root();
+      inode_ptr get_cwd();
+      void set_cwd (inode_ptr);
+      file_tree& get_tree();
+      inode_table& get_table();
+      ostream& out() { return *output; }
+      void set_out (ostream& stream) { output = &stream; }
+      worker_pool* get_workers() { return workers; }
+      void set_workers (worker_pool* pool) { workers = pool; }
+      // Helper functions
+      inode_ptr find_inode_ptr (string_view, const inode_ptr&);
+      token_list pathname_to_tokens (string_view);
+      inode_ptr tokens_to_inode_ptr (const token_list&);
+      inode_ptr pathname_to_inode_ptr (string_view);
+      void glob (string_view pathname, vector<glob_match>& matches);
+      const dentry_cache& get_dcache() const;
 };
 
 #endif
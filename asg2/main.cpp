@@ -1,9 +1,17 @@
 // $Id: main.cpp,v 1.2 2016-01-30 02:29:51-08 - - $
 // Ana Carolina Alves - adalves
 
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <mutex>
+#include <shared_mutex>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <utility>
 #include <unistd.h>
 
@@ -15,17 +23,59 @@ using namespace std;
 #include "util.h"
 
 // scan_options
-//    Options analysis:  The only option is -Dflags. 
+//    Options analysis:  -@flags sets debug flags, and -l image
+//    names a file written by the save command, which is loaded
+//    before any commands are read.  -b selects batch mode, and -e
+//    asks for the prompt and commands to be echoed in batch mode.
+//    -r sessions selects replay mode, with that many sessions.
+//    -j workers sets the number of threads lsr may use, which is by
+//    default the number the hardware can run at once.  -J journal
+//    names a journal, which is replayed after any image is loaded,
+//    and then records every change made to the tree.
+
+string image_filename;
+string journal_filename;
+bool batch_mode = false;
+bool batch_echo = false;
+size_t replay_sessions = 0;
+size_t lsr_workers = max (thread::hardware_concurrency(), 1u);
 
 void scan_options (int argc, char** argv) {
    opterr = 0;
    for (;;) {
-      int option = getopt (argc, argv, "@:");
+      int option = getopt (argc, argv, "@:bej:J:l:r:");
       if (option == EOF) break;
       switch (option) {
          case '@':
             debugflags::setflags (optarg);
             break;
+         case 'b':
+            batch_mode = true;
+            break;
+         case 'e':
+            batch_echo = true;
+            break;
+         case 'j':
+            lsr_workers = strtoul (optarg, nullptr, 10);
+            if (lsr_workers == 0) {
+               complain() << "-j " << optarg << ": invalid workers"
+                          << endl;
+               lsr_workers = 1;
+            }
+            break;
+         case 'J':
+            journal_filename = optarg;
+            break;
+         case 'l':
+            image_filename = optarg;
+            break;
+         case 'r':
+            replay_sessions = strtoul (optarg, nullptr, 10);
+            if (replay_sessions == 0) {
+               complain() << "-r " << optarg << ": invalid sessions"
+                          << endl;
+            }
+            break;
          default:
             complain() << "-" << static_cast<char> (option)
                        << ": invalid option" << endl;
@@ -37,6 +87,180 @@ void scan_options (int argc, char** argv) {
    }
 }
 
+// run_command -
+//    Split the line into words and lookup the appropriate function.
+//    Complain or call it, holding the tree shared or exclusively as
+//    the command needs.  The words are views into the line, so in
+//    the common case nothing is allocated for them.
+
+void run_command (inode_state& state, string_view line) {
+   token_list words = split (line, " \t");
+   DEBUGF ('y', "words = " << words);
+   if (words.empty()) return;
+   const command_entry* cmd = find_command (words.at(0));
+   command_status status {words.at(0), {}, "No such function"};
+   if (cmd != nullptr) {
+      shared_mutex& access = state.get_tree().get_access();
+      switch (cmd -> access) {
+         case command_access::NONE:
+            status = cmd -> fn (state, words);
+            break;
+         case command_access::READ: {
+            shared_lock<shared_mutex> lock (access);
+            status = cmd -> fn (state, words);
+            break;
+         }
+         case command_access::WRITE: {
+            lock_guard<shared_mutex> lock (access);
+            status = cmd -> fn (state, words);
+            break;
+         }
+      }
+   }
+   // If there is a problem discovered in any function, it is
+   // returned and printed here.
+   if (!status) report (status);
+}
+
+// report_rate -
+//    Reports on standard error how many commands were run since
+//    start, and how many per second.
+
+void report_rate (const string& what, size_t commands,
+                  chrono::steady_clock::time_point start) {
+   chrono::duration<double> elapsed =
+         chrono::steady_clock::now() - start;
+   cerr << execname() << ": " << what << commands << " commands in "
+        << elapsed.count() << " s";
+   if (elapsed.count() > 0) {
+      cerr << ", " << static_cast<size_t> (commands / elapsed.count())
+           << " commands/s";
+   }
+   cerr << endl;
+}
+
+// run_batch -
+//    Batch mode.  Standard input is read in large blocks and split
+//    into lines without going through cin.  A line that lies within
+//    a block is run in place, and only one that straddles two blocks
+//    is copied.  Standard output is written only as its buffer
+//    fills, whatever the commands flush.
+//    Error messages still appear in order with the output, since
+//    writing one first writes out everything before it.  When the
+//    script ends, the number of commands run and the rate are
+//    reported on standard error.
+
+void run_batch (inode_state& state) {
+   constexpr size_t block_size = 1 << 20;
+   fd_buffer out_buffer (STDOUT_FILENO, 1 << 16, false);
+   fd_buffer err_buffer (STDERR_FILENO, 1 << 10, true, &out_buffer);
+   streambuf* cout_buffer = cout.rdbuf (&out_buffer);
+   streambuf* cerr_buffer = cerr.rdbuf (&err_buffer);
+   vector<char> block (block_size);
+   string line;
+   size_t commands = 0;
+   auto start = chrono::steady_clock::now();
+
+   auto run = [&] (string_view text) {
+      if (batch_echo) cout << state.get_prompt() << text << "\n";
+      run_command (state, text);
+      ++commands;
+   };
+   auto report = [&] () {
+      report_rate ("", commands, start);
+      cout.rdbuf (cout_buffer);
+      cerr.rdbuf (cerr_buffer);
+   };
+
+   try {
+      for (;;) {
+         ssize_t count = read (STDIN_FILENO, block.data(), block_size);
+         if (count < 0 and errno == EINTR) continue;
+         if (count < 0) {
+            complain() << "stdin: " << strerror (errno) << endl;
+            break;
+         }
+         if (count == 0) break;
+         const char* pos = block.data();
+         const char* end = pos + count;
+         for (;;) {
+            const char* newline = static_cast<const char*> (
+                                  memchr (pos, '\n', end - pos));
+            if (newline == nullptr) {
+               line.append (pos, end);
+               break;
+            }
+            if (line.empty()) {
+               run (string_view (pos, newline - pos));
+            } else {
+               line.append (pos, newline);
+               run (line);
+               line.clear();
+            }
+            pos = newline + 1;
+         }
+      }
+      if (!line.empty()) run (line);
+      DEBUGF ('y', "EOF");
+      token_list temp = {"exit"};
+      fn_exit (state, temp);
+   }catch (...) {
+      report();
+      throw;
+   }
+}
+
+// run_sessions -
+//    Replay mode.  Standard input is read whole, and then run as a
+//    script by each of several sessions at once, each on a thread of
+//    its own, all sharing the tree.  The tree is meant to be loaded
+//    with -l and the script to only read it, so every session sees
+//    the same tree and writes the same output, which is discarded.
+//    A session ends at the end of the script or at exit.  The number
+//    of commands run by all the sessions, and the rate, are reported
+//    on standard error, so runs with different numbers of sessions
+//    show how reading scales.
+
+void run_sessions (inode_state& state, size_t sessions) {
+   ostringstream input;
+   input << cin.rdbuf();
+   string script = input.str();
+   vector<string_view> lines;
+   for (size_t pos = 0; pos < script.size(); ) {
+      size_t newline = script.find ('\n', pos);
+      if (newline == string::npos) newline = script.size();
+      lines.push_back (string_view (script).substr (pos,
+                                                    newline - pos));
+      pos = newline + 1;
+   }
+
+   atomic<size_t> commands {0};
+   auto session = [&] () {
+      inode_state replay (state.get_tree());
+      ostream discard (nullptr);
+      replay.set_out (discard);
+      replay.set_workers (state.get_workers());
+      size_t count = 0;
+      try {
+         for (string_view line: lines) {
+            ++count;
+            run_command (replay, line);
+         }
+      }catch (ysh_exit&) {
+      }
+      commands += count;
+   };
+   auto start = chrono::steady_clock::now();
+   vector<thread> threads;
+   for (size_t count = 0; count < sessions; ++count) {
+      threads.emplace_back (session);
+   }
+   for (thread& worker: threads) worker.join();
+   report_rate (to_string (sessions) + " sessions, ", commands, start);
+   token_list temp = {"exit"};
+   fn_exit (state, temp);
+}
+
 // main -
 //    Main program which loops reading commands until end of file.
 
@@ -47,42 +271,57 @@ int main (int argc, char** argv) {
    cout << argv[0] << " build " << __DATE__ << " " << __TIME__ << endl;
    scan_options (argc, argv);
    bool need_echo = want_echo();
-   inode_state state;
+   journal log;
+   file_tree tree;
+   worker_pool workers (lsr_workers);
+   inode_state state (tree);
+   state.set_workers (&workers);
+   if (!image_filename.empty()) {
+      result<> loaded = tree.load_image (image_filename);
+      if (!loaded) {
+         complain() << image_filename << ": " << loaded.error() << endl;
+      }
+   }
+   // Changes made without the journal could not be recovered, so if
+   // it cannot be opened, nothing is run.
+   if (!journal_filename.empty()) {
+      result<size_t> opened = tree.open_journal (log, journal_filename);
+      if (!opened) {
+         complain() << journal_filename << ": " << opened.error()
+                    << endl;
+         return exit_status_message();
+      }
+   }
    try {
+      // run_sessions and run_batch end by calling fn_exit, like the
+      // loop below.
+      if (replay_sessions > 0) run_sessions (state, replay_sessions);
+      if (batch_mode) run_batch (state);
+      // The line keeps its capacity from one command to the next.
+      string line;
       for (;;) {
-         try {
-            // Read a line, break at EOF, and echo print the prompt
-            // if one is needed.
-            cout << state.get_prompt();
-            string line;
-            getline (cin, line);
-            if (cin.eof()) {
-               if (need_echo) cout << "^D";
-               cout << endl;
-               DEBUGF ('y', "EOF");
-               wordvec temp = {"exit"};
-               fn_exit (state, temp);
-               break;
-            }
-            if (need_echo) cout << line << endl;
-   
-            // Split the line into words and lookup the appropriate
-            // function.  Complain or call it.
-            wordvec words = split (line, " \t");
-            DEBUGF ('y', "words = " << words);
-            if (!words.empty()) {
-               command_fn fn = find_command_fn (words.at(0));
-               fn (state, words);
-            }
-         }catch (command_error& error) {
-            // If there is a problem discovered in any function, an
-            // exn is thrown and printed here.
-            complain() << error.what() << endl;
+         // Read a line, break at EOF, and echo print the prompt
+         // if one is needed.
+         cout << state.get_prompt();
+         getline (cin, line);
+         if (cin.eof()) {
+            if (need_echo) cout << "^D";
+            cout << endl;
+            DEBUGF ('y', "EOF");
+            token_list temp = {"exit"};
+            fn_exit (state, temp);
+            break;
          }
+         if (need_echo) cout << line << endl;
+         run_command (state, line);
       }
    } catch (ysh_exit&) {
       // This catch intentionally left blank.
    }
+   result<> closed = log.close();
+   if (!closed) {
+      complain() << journal_filename << ": " << closed.error() << endl;
+   }
    
    return exit_status_message();
 }
@@ -0,0 +1,89 @@
+// $Id$
+// Ana Carolina Alves - adalves
+
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+using namespace std;
+
+// slab -
+//    An arena of item_t objects allocated in fixed-size chunks.
+//    Chunks are never moved or returned to the system until the
+//    slab is destroyed, so a pointer to an item stays valid until
+//    the item is freed.  Freed slots are reused before new ones are
+//    taken from the end of the last chunk, so allocation is either
+//    a pop from the free list or a bump of the high water mark.
+// handle -
+//    Names a slot by index together with the generation of the item
+//    in it.  Freeing an item advances the slot's generation, so a
+//    handle to it no longer matches and get returns nullptr, even
+//    after the slot has been reused.  A default handle is never
+//    valid.
+// make -
+//    Constructs an item in a free slot and returns a pointer to it.
+// get -
+//    Returns the item named by a handle, or nullptr if it is stale.
+// in_slot -
+//    Returns the item in the slot a handle names, even if the handle
+//    is stale, or nullptr if the slot is free or out of range.
+// handle_of -
+//    Returns the handle of a live item.
+// invalidate -
+//    Advances the generation of a live item without destroying it,
+//    so handles to it given out so far become stale.
+// free -
+//    Destroys an item and returns its slot to the free list.
+// swap -
+//    Exchanges the contents of two slabs.  Pointers to the items
+//    stay valid, and handles must be used with the slab that now
+//    holds their items.
+// size -
+//    The number of live items.
+
+template <typename item_t>
+class slab {
+   public:
+      struct handle {
+         uint32_t index {0};
+         uint32_t generation {0};
+      };
+   private:
+      // The item must be first, so a pointer to it is also a
+      // pointer to its slot.
+      struct slot {
+         typename aligned_storage<sizeof (item_t),
+                                  alignof (item_t)>::type storage;
+         uint32_t index;
+         uint32_t generation;
+         bool live;
+      };
+      static constexpr size_t CHUNK_SLOTS = 4096;
+      vector<unique_ptr<slot[]>> chunks;
+      vector<uint32_t> free_slots;
+      size_t used {0};
+      size_t live_count {0};
+      slot& at (uint32_t index) const;
+      static slot& slot_of (const item_t* item);
+   public:
+      slab() = default;
+      slab (const slab&) = delete;
+      slab& operator= (const slab&) = delete;
+      ~slab();
+      template <typename... args_t>
+      item_t* make (args_t&&... args);
+      item_t* get (handle) const;
+      item_t* in_slot (handle) const;
+      handle handle_of (const item_t* item) const;
+      void invalidate (const item_t* item);
+      void free (item_t* item);
+      void swap (slab& that);
+      size_t size() const { return live_count; }
+};
+
+#include "slab.tcc"
+#endif
+
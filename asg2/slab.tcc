@@ -0,0 +1,115 @@
+// $Id$
+// Ana Carolina Alves - adalves
+
+#include <new>
+#include <utility>
+
+#include "slab.h"
+
+//
+// slab::~slab() -
+//    Destroys the items still live.  Nothing is reachable from one
+//    item to another, so this is a single sweep over the chunks.
+//
+template <typename item_t>
+slab<item_t>::~slab() {
+   for (size_t index = 0; index < used; ++index) {
+      slot& where = at (index);
+      if (where.live) {
+         reinterpret_cast<item_t*> (&where.storage) -> ~item_t();
+      }
+   }
+}
+
+template <typename item_t>
+typename slab<item_t>::slot& slab<item_t>::at (uint32_t index) const {
+   return chunks[index / CHUNK_SLOTS][index % CHUNK_SLOTS];
+}
+
+template <typename item_t>
+typename slab<item_t>::slot& slab<item_t>::slot_of
+                             (const item_t* item) {
+   return *reinterpret_cast<slot*> (const_cast<item_t*> (item));
+}
+
+//
+// item_t* slab::make (args_t&&...) -
+//    If the constructor throws, the slot goes back on the free list
+//    with its generation unchanged, since no handle to it was ever
+//    given out.
+//
+template <typename item_t>
+template <typename... args_t>
+item_t* slab<item_t>::make (args_t&&... args) {
+   uint32_t index;
+   if (!free_slots.empty()) {
+      index = free_slots.back();
+      free_slots.pop_back();
+   } else {
+      if (used % CHUNK_SLOTS == 0) {
+         chunks.emplace_back (new slot[CHUNK_SLOTS]());
+      }
+      index = used++;
+      at (index).index = index;
+      at (index).generation = 1;
+   }
+   slot& where = at (index);
+   try {
+      new (&where.storage) item_t (forward<args_t> (args)...);
+   } catch (...) {
+      free_slots.push_back (index);
+      throw;
+   }
+   where.live = true;
+   ++live_count;
+   return reinterpret_cast<item_t*> (&where.storage);
+}
+
+template <typename item_t>
+item_t* slab<item_t>::get (handle name) const {
+   if (name.index >= used) return nullptr;
+   slot& where = at (name.index);
+   if (!where.live or where.generation != name.generation) {
+      return nullptr;
+   }
+   return reinterpret_cast<item_t*> (&where.storage);
+}
+
+template <typename item_t>
+item_t* slab<item_t>::in_slot (handle name) const {
+   if (name.index >= used) return nullptr;
+   slot& where = at (name.index);
+   if (!where.live) return nullptr;
+   return reinterpret_cast<item_t*> (&where.storage);
+}
+
+template <typename item_t>
+typename slab<item_t>::handle slab<item_t>::handle_of
+                              (const item_t* item) const {
+   const slot& where = slot_of (item);
+   return {where.index, where.generation};
+}
+
+template <typename item_t>
+void slab<item_t>::invalidate (const item_t* item) {
+   ++slot_of (item).generation;
+}
+
+template <typename item_t>
+void slab<item_t>::swap (slab& that) {
+   chunks.swap (that.chunks);
+   free_slots.swap (that.free_slots);
+   std::swap (used, that.used);
+   std::swap (live_count, that.live_count);
+}
+
+template <typename item_t>
+void slab<item_t>::free (item_t* item) {
+   slot& where = slot_of (item);
+   item -> ~item_t();
+   where.live = false;
+   ++where.generation;
+   --live_count;
+   free_slots.push_back (where.index);
+}
+
@@ -1,7 +1,13 @@
 // $Id: util.cpp,v 1.1 2016-01-29 17:25:28-08 - - $
 // Ana Carolina Alves - adalves
 
+#include <algorithm>
+#include <cerrno>
 #include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 using namespace std;
@@ -9,7 +15,7 @@ using namespace std;
 #include "util.h"
 #include "debug.h"
 
-int exit_status::status = EXIT_SUCCESS;
+atomic<int> exit_status::status {EXIT_SUCCESS};
 static string execname_string;
 
 void exit_status::set (int new_status) {
@@ -39,15 +45,60 @@ bool want_echo() {
    return cin_is_not_a_tty or cout_is_not_a_tty;
 }
 
-wordvec split (const string& line, const string& delimiters) {
-   wordvec words;
+token_list::token_list (initializer_list<string_view> tokens) {
+   for (string_view token: tokens) push_back (token);
+}
+
+token_list::const_iterator token_list::begin() const {
+   return more_tokens.empty() ? inline_tokens.data()
+                              : more_tokens.data();
+}
+
+const string_view& token_list::at (size_t index) const {
+   if (index >= count) throw out_of_range ("token_list::at");
+   return begin()[index];
+}
+
+//
+// Once the inline array is full, all of the tokens move to the
+// vector, so they are always contiguous.
+//
+void token_list::push_back (string_view token) {
+   if (more_tokens.empty() and count < INLINE_TOKENS) {
+      inline_tokens[count++] = token;
+      return;
+   }
+   if (more_tokens.empty()) {
+      more_tokens.reserve (2 * INLINE_TOKENS);
+      more_tokens.assign (inline_tokens.cbegin(), inline_tokens.cend());
+   }
+   more_tokens.push_back (token);
+   ++count;
+}
+
+void token_list::pop_back() {
+   if (!more_tokens.empty()) more_tokens.pop_back();
+   --count;
+}
+
+void token_list::clear() {
+   more_tokens.clear();
+   count = 0;
+}
+
+ostream& operator<< (ostream& out, const token_list& tokens) {
+   return out << token_range (tokens.begin(), tokens.end());
+}
+
+token_list split (string_view line, string_view delimiters) {
+   token_list words;
    size_t end = 0;
 
    // Loop over the string, splitting out words, and for each word
-   // thus found, append it to the output wordvec.
+   // thus found, append it to the output token_list.
    for (;;) {
       size_t start = line.find_first_not_of (delimiters, end);
-      if (start == string::npos) break;
+      if (start == string_view::npos) break;
       end = line.find_first_of (delimiters, start);
       words.push_back (line.substr (start, end - start));
    }
@@ -61,3 +112,433 @@ ostream& complain() {
    return cerr;
 }
 
+bool contains (string_view haystack, string_view needle) {
+   if (needle.empty()) return true;
+   return memmem (haystack.data(), haystack.size(),
+                  needle.data(), needle.size()) != nullptr;
+}
+
+glob_pattern::glob_pattern (string_view pattern) {
+   pieces.emplace_back();
+   leading_dot = !pattern.empty() and pattern.front() == '.';
+   for (size_t pos = 0; pos < pattern.size(); ++pos) {
+      unsigned char ch = pattern[pos];
+      if (ch == '*') {
+         pieces.emplace_back();
+         continue;
+      }
+      piece& part = pieces.back();
+      if (ch == '?') {
+         part.atoms.push_back ({atom::ANY, 0, 0});
+         part.is_literal = false;
+      } else if (ch == '[') {
+         size_t end = compile_set (pattern, pos);
+         if (end == pos) {
+            part.atoms.push_back ({atom::CHAR, ch, 0});
+            part.literal += ch;
+         } else {
+            part.atoms.push_back ({atom::SET, 0, sets.size() - 1});
+            part.is_literal = false;
+            pos = end;
+         }
+      } else {
+         part.atoms.push_back ({atom::CHAR, ch, 0});
+         part.literal += ch;
+      }
+   }
+}
+
+//
+// Compiles the set whose "[" is at pos into a new entry of sets, and
+// returns the position of its "]", or pos if there is none.  A "]"
+// first in the set is a member of it.
+//
+size_t glob_pattern::compile_set (string_view pattern, size_t pos) {
+   size_t end = pos + 1;
+   bool complement = end < pattern.size()
+                 and (pattern[end] == '!' or pattern[end] == '^');
+   if (complement) ++end;
+   if (end < pattern.size() and pattern[end] == ']') ++end;
+   end = pattern.find (']', end);
+   if (end == string_view::npos) return pos;
+
+   bitset<256> members;
+   size_t first = pos + 1 + complement;
+   for (size_t member = first; member < end; ++member) {
+      unsigned char low = pattern[member];
+      unsigned char high = low;
+      if (member + 2 < end and pattern[member + 1] == '-') {
+         high = pattern[member + 2];
+         member += 2;
+      }
+      for (unsigned ch = low; ch <= high; ++ch) members.set (ch);
+   }
+   if (complement) members.flip();
+   sets.push_back (members);
+   return end;
+}
+
+bool glob_pattern::match_at (const piece& part, string_view name,
+                             size_t pos) const {
+   for (const atom& each: part.atoms) {
+      unsigned char ch = name[pos++];
+      switch (each.kind) {
+         case atom::CHAR: if (ch != each.ch) return false; break;
+         case atom::ANY: break;
+         case atom::SET: if (!sets[each.set][ch]) return false; break;
+      }
+   }
+   return true;
+}
+
+//
+// Returns the first position at or after pos where part matches and
+// ends by limit, or npos if there is none.
+//
+size_t glob_pattern::find (const piece& part, string_view name,
+                           size_t pos, size_t limit) const {
+   size_t length = part.atoms.size();
+   if (part.is_literal) {
+      return name.substr (0, limit).find (part.literal, pos);
+   }
+   for (; pos + length <= limit; ++pos) {
+      if (match_at (part, name, pos)) return pos;
+   }
+   return string_view::npos;
+}
+
+bool glob_pattern::matches (string_view name) const {
+   if (!name.empty() and name.front() == '.' and !leading_dot) {
+      return false;
+   }
+   const piece& first = pieces.front();
+   if (pieces.size() == 1) {
+      return name.size() == first.atoms.size()
+         and match_at (first, name, 0);
+   }
+   const piece& last = pieces.back();
+   if (name.size() < first.atoms.size() + last.atoms.size()) {
+      return false;
+   }
+   size_t limit = name.size() - last.atoms.size();
+   if (!match_at (first, name, 0) or !match_at (last, name, limit)) {
+      return false;
+   }
+   size_t pos = first.atoms.size();
+   for (size_t index = 1; index + 1 < pieces.size(); ++index) {
+      const piece& part = pieces[index];
+      pos = find (part, name, pos, limit);
+      if (pos == string_view::npos) return false;
+      pos += part.atoms.size();
+   }
+   return true;
+}
+
+bool glob_pattern::has_wildcards (string_view word) {
+   return word.find_first_of ("*?[") != string_view::npos;
+}
+
+
+fd_buffer::fd_buffer (int fd, size_t size, bool write_on_sync,
+                      fd_buffer* preceding):
+           fd (fd), buffer (max<size_t> (size, 1)),
+           write_on_sync (write_on_sync),
+           preceding (preceding) {
+   setp (buffer.data(), buffer.data() + buffer.size());
+}
+
+fd_buffer::~fd_buffer() {
+   flush();
+}
+
+//
+// Write errors are ignored, as they would be by cout:  there is
+// nowhere left to report them.
+//
+void fd_buffer::write_out() {
+   const char* begin = pbase();
+   while (begin < pptr()) {
+      ssize_t count = write (fd, begin, pptr() - begin);
+      if (count < 0 and errno == EINTR) continue;
+      if (count <= 0) break;
+      begin += count;
+   }
+   setp (buffer.data(), buffer.data() + buffer.size());
+}
+
+void fd_buffer::flush() {
+   if (preceding != nullptr) preceding -> flush();
+   write_out();
+}
+
+fd_buffer::int_type fd_buffer::overflow (int_type ch) {
+   flush();
+   if (traits_type::eq_int_type (ch, traits_type::eof())) {
+      return traits_type::not_eof (ch);
+   }
+   *pptr() = traits_type::to_char_type (ch);
+   pbump (1);
+   return ch;
+}
+
+int fd_buffer::sync() {
+   if (write_on_sync) flush();
+   return 0;
+}
+
+worker_pool::worker_pool (size_t threads) {
+   for (size_t count = 1; count < threads; ++count) {
+      workers.emplace_back (&worker_pool::work, this);
+   }
+}
+
+worker_pool::~worker_pool() {
+   {
+      lock_guard<mutex> guard (lock);
+      stopping = true;
+   }
+   wake.notify_all();
+   for (thread& worker: workers) worker.join();
+}
+
+void worker_pool::take_tasks (const function<void (size_t)>& job,
+                              size_t job_count) {
+   for (;;) {
+      size_t index = next++;
+      if (index >= job_count) break;
+      job (index);
+   }
+}
+
+//
+// Every worker takes part in every job, even if there is nothing
+// left for it to do, and run waits for all of them, so no worker can
+// miss a job or see the next one before it is done with this one.
+//
+void worker_pool::work() {
+   size_t seen = 0;
+   unique_lock<mutex> guard (lock);
+   for (;;) {
+      wake.wait (guard, [this, seen] {
+         return stopping or generation != seen;
+      });
+      if (stopping) return;
+      seen = generation;
+      const function<void (size_t)>& job = *task;
+      size_t job_count = count;
+      guard.unlock();
+      take_tasks (job, job_count);
+      guard.lock();
+      if (--busy == 0) done.notify_one();
+   }
+}
+
+void worker_pool::run (size_t count,
+                       const function<void (size_t)>& task) {
+   unique_lock<mutex> job (running, try_to_lock);
+   if (!job.owns_lock() or workers.empty() or count <= 1) {
+      for (size_t index = 0; index < count; ++index) task (index);
+      return;
+   }
+   {
+      lock_guard<mutex> guard (lock);
+      this -> task = &task;
+      this -> count = count;
+      next = 0;
+      busy = workers.size();
+      ++generation;
+   }
+   wake.notify_all();
+   take_tasks (task, count);
+   unique_lock<mutex> guard (lock);
+   done.wait (guard, [this] { return busy == 0; });
+}
+
+static const string journal_magic = {'y', 's', 'j', 1};
+constexpr size_t journal_header = 8;
+
+//
+// The bytes are taken eight at a time, each word mixed in by a
+// multiplication and a shift, so the checksum costs little next to
+// replaying a record.  It only has to catch records that a crash
+// cut off or left half written.
+//
+static uint32_t checksum (string_view bytes) {
+   constexpr uint64_t multiplier = 0x9e3779b97f4a7c15;
+   uint64_t hash = bytes.size() * multiplier;
+   size_t pos = 0;
+   for (; pos + 8 <= bytes.size(); pos += 8) {
+      uint64_t word;
+      memcpy (&word, bytes.data() + pos, 8);
+      hash = (hash ^ word) * multiplier;
+      hash ^= hash >> 29;
+   }
+   uint64_t word = 0;
+   memcpy (&word, bytes.data() + pos, bytes.size() - pos);
+   hash = (hash ^ word) * multiplier;
+   hash ^= hash >> 29;
+   return static_cast<uint32_t> (hash ^ (hash >> 32));
+}
+
+static void put_journal_int (string& buffer, uint32_t value) {
+   for (size_t byte = 0; byte < 4; ++byte) {
+      buffer += static_cast<char> (value >> (byte * 8));
+   }
+}
+
+static uint32_t get_journal_int (const char* bytes) {
+   uint32_t value = 0;
+   for (size_t byte = 0; byte < 4; ++byte) {
+      uint32_t bits = static_cast<unsigned char> (bytes[byte]);
+      value |= bits << (byte * 8);
+   }
+   return value;
+}
+
+static bool write_all (int fd, const char* begin, const char* end) {
+   while (begin < end) {
+      ssize_t count = write (fd, begin, end - begin);
+      if (count < 0 and errno == EINTR) continue;
+      if (count <= 0) return false;
+      begin += count;
+   }
+   return true;
+}
+
+journal::~journal() {
+   close();
+}
+
+//
+// The existing records are mapped into memory rather than read.  A
+// new or empty journal gets its magic number, synced before any
+// record can follow it, as does one that holds only the start of
+// it, left by a crash while it was written.
+//
+result<size_t> journal::open (const string& filename,
+                              const replay_fn& replay) {
+   int file = ::open (filename.c_str(), O_RDWR | O_CREAT | O_APPEND,
+                      0666);
+   if (file < 0) return failure {"cannot open"};
+   struct stat info;
+   if (fstat (file, &info) < 0) {
+      ::close (file);
+      return failure {"cannot stat"};
+   }
+   size_t length = info.st_size;
+   size_t good = journal_magic.size();
+   size_t records = 0;
+   if (length < journal_magic.size()) {
+      string start (length, '\0');
+      if (pread (file, start.data(), length, 0)
+             != static_cast<ssize_t> (length)
+          or journal_magic.compare (0, length, start) != 0) {
+         ::close (file);
+         return failure {"not a yshell journal"};
+      }
+      if (ftruncate (file, 0) < 0
+          or !write_all (file, journal_magic.data(),
+                         journal_magic.data() + journal_magic.size())
+          or fdatasync (file) < 0) {
+         ::close (file);
+         return failure {"write error"};
+      }
+   } else {
+      void* map = mmap (nullptr, length, PROT_READ, MAP_PRIVATE,
+                        file, 0);
+      if (map == MAP_FAILED) {
+         ::close (file);
+         return failure {"cannot map"};
+      }
+      madvise (map, length, MADV_SEQUENTIAL);
+      string_view bytes (static_cast<const char*> (map), length);
+      if (bytes.substr (0, journal_magic.size()) != journal_magic) {
+         munmap (map, length);
+         ::close (file);
+         return failure {"not a yshell journal"};
+      }
+      while (length - good >= journal_header) {
+         uint32_t size = get_journal_int (bytes.data() + good);
+         uint32_t stored = get_journal_int (bytes.data() + good + 4);
+         if (length - good - journal_header < size) break;
+         string_view record = bytes.substr (good + journal_header,
+                                            size);
+         if (checksum (record) != stored) break;
+         result<> replayed = replay (record);
+         if (!replayed) {
+            munmap (map, length);
+            ::close (file);
+            return failure {replayed.error()};
+         }
+         good += journal_header + size;
+         ++records;
+      }
+      munmap (map, length);
+      if (good < length and ftruncate (file, good) < 0) {
+         ::close (file);
+         return failure {"cannot truncate"};
+      }
+   }
+   fd = file;
+   stopping = false;
+   error = nullptr;
+   writer = thread (&journal::write_out, this);
+   return records;
+}
+
+void journal::append (string_view record) {
+   bool was_idle;
+   {
+      lock_guard<mutex> guard (lock);
+      if (fd < 0 or error != nullptr) return;
+      put_journal_int (pending, record.size());
+      put_journal_int (pending, checksum (record));
+      pending += record;
+      was_idle = idle;
+      idle = false;
+   }
+   if (was_idle) wake.notify_one();
+}
+
+//
+// The buffers are swapped rather than copied, and each keeps its
+// capacity, so once they have grown, appending does not allocate.
+//
+void journal::write_out() {
+   unique_lock<mutex> guard (lock);
+   for (;;) {
+      if (!stopping and pending.empty()) {
+         idle = true;
+         wake.wait (guard, [this] {
+            return stopping or !pending.empty();
+         });
+      }
+      if (pending.empty()) return;
+      writing.swap (pending);
+      guard.unlock();
+      bool written = write_all (fd, writing.data(),
+                                writing.data() + writing.size())
+                 and fdatasync (fd) == 0;
+      writing.clear();
+      guard.lock();
+      if (!written) {
+         error = "write error";
+         pending.clear();
+         return;
+      }
+   }
+}
+
+result<> journal::close() {
+   if (fd < 0) return {};
+   {
+      lock_guard<mutex> guard (lock);
+      stopping = true;
+   }
+   wake.notify_one();
+   writer.join();
+   ::close (fd);
+   fd = -1;
+   if (error != nullptr) return failure {error};
+   return {};
+}
@@ -8,9 +8,19 @@
 #ifndef __UTIL_H__
 #define __UTIL_H__
 
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <condition_variable>
+#include <functional>
 #include <iostream>
+#include <mutex>
 #include <stdexcept>
+#include <streambuf>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <variant>
 #include <vector>
 using namespace std;
 
@@ -22,6 +32,64 @@ using range_type = pair<iterator,iterator>;
 using wordvec = vector<string>;
 using word_range = range_type<decltype(declval<wordvec>().cbegin())>;
 
+// token_list -
+//    A sequence of string_views, such as the words of a command
+//    line.  The first INLINE_TOKENS are stored in the object itself,
+//    so splitting a short line does not allocate memory.  The views
+//    refer to the characters of the string that was split, which
+//    must outlive the token_list.
+
+class token_list {
+   private:
+      static constexpr size_t INLINE_TOKENS = 8;
+      array<string_view,INLINE_TOKENS> inline_tokens;
+      vector<string_view> more_tokens;
+      size_t count {0};
+   public:
+      using const_iterator = const string_view*;
+      token_list() = default;
+      token_list (initializer_list<string_view> tokens);
+      size_t size() const { return count; }
+      bool empty() const { return count == 0; }
+      const_iterator begin() const;
+      const_iterator end() const { return begin() + count; }
+      const string_view& at (size_t index) const;
+      const string_view& back() const { return end()[-1]; }
+      void push_back (string_view token);
+      void pop_back();
+      void clear();
+};
+
+using token_range = range_type<token_list::const_iterator>;
+ostream& operator<< (ostream& out, const token_list& tokens);
+
+// failure, result -
+//    The outcome of an operation whose failure is routine, in the
+//    style of std::expected:  either a value or an error message.
+//    A failure is returned like any other value instead of being
+//    thrown, so it costs no unwinding.  Messages are string
+//    literals, so failing does not allocate either.  A result<>
+//    carries no value, only success or failure.
+
+struct failure {
+   const char* message;
+};
+
+template <typename value_t = monostate>
+class result {
+   private:
+      value_t value_ {};
+      const char* error_ {nullptr};
+   public:
+      result() = default;
+      result (value_t value): value_ (move (value)) {}
+      result (failure fail): error_ (fail.message) {}
+      explicit operator bool() const { return error_ == nullptr; }
+      value_t& value() { return value_; }
+      const value_t& value() const { return value_; }
+      const char* error() const { return error_; }
+};
+
 // setexecname -
 //    Sets the static string to be used as an execname.
 // execname -
@@ -42,22 +110,74 @@ bool want_echo();
 //    A static class for maintaining the exit status.  The default
 //    status is EXIT_SUCCESS (0), but can be set to another value,
 //    such as EXIT_FAILURE (1) to indicate that error messages have
-//    been printed.
+//    been printed.  Sessions on other threads may set it at once.
 
 class exit_status {
    private:
-      static int status;
+      static atomic<int> status;
    public:
       static void set (int);
       static int get();
 };
 
 // split -
-//    Split a string into a wordvec (as defined above).  Any sequence
-//    of chars in the delimiter string is used as a separator.  To
-//    Split a pathname, use "/".  To split a shell command, use " ".
+//    Split a string into a token_list (as defined above).  Any
+//    sequence of chars in the delimiter string is used as a
+//    separator.  To Split a pathname, use "/".  To split a shell
+//    command, use " ".
+
+token_list split (string_view line, string_view delimiter);
+
+// glob_pattern -
+//    A shell wildcard pattern, compiled once and then matched against
+//    any number of names.  "*" matches any string, "?" any one char,
+//    and "[...]" any one char in the set, which may hold ranges such
+//    as "a-z", and is complemented by a leading "!" or "^".  A "["
+//    with no closing "]" is an ordinary char, and there are no
+//    escapes.  As in sh, a name beginning with "." is matched only
+//    by a pattern that begins with one too.  The pattern is compiled
+//    into the pieces between the stars, each of which matches a
+//    fixed number of chars, so the first piece is matched at the
+//    start of a name, the last at the end, and each of the others
+//    where it first occurs after the one before it.  That needs no
+//    backtracking, and pieces with no wildcards are found with
+//    string_view::find.
+// has_wildcards -
+//    Whether a word holds any of the chars above, and so should be
+//    matched as a pattern rather than looked up as a name.
+
+class glob_pattern {
+   private:
+      struct atom {
+         enum {CHAR, ANY, SET} kind;
+         unsigned char ch;
+         size_t set;
+      };
+      struct piece {
+         vector<atom> atoms;
+         string literal;
+         bool is_literal {true};
+      };
+      vector<piece> pieces;
+      vector<bitset<256>> sets;
+      bool leading_dot {false};
+      size_t compile_set (string_view pattern, size_t pos);
+      bool match_at (const piece& part, string_view name,
+                     size_t pos) const;
+      size_t find (const piece& part, string_view name, size_t pos,
+                   size_t limit) const;
+   public:
+      explicit glob_pattern (string_view pattern);
+      bool matches (string_view name) const;
+      static bool has_wildcards (string_view word);
+};
+
+// contains -
+//    Whether needle occurs in haystack.  The search is memmem's,
+//    which the C library vectorizes, so a buffer is scanned many
+//    bytes at a time.
 
-wordvec split (const string& line, const string& delimiter);
+bool contains (string_view haystack, string_view needle);
 
 // complain -
 //    Used for starting error messages.  Sets the exit status to
@@ -67,6 +187,122 @@ wordvec split (const string& line, const string& delimiter);
 
 ostream& complain();
 
+// fd_buffer -
+//    A streambuf which writes to a file descriptor in large blocks.
+//    Unless write_on_sync is set, flushing the stream (with endl,
+//    flush, or through a tied stream) writes nothing, so output is
+//    written only when the buffer fills or flush is called, and when
+//    the fd_buffer is destroyed.  If a preceding fd_buffer is given,
+//    it is flushed before anything is written by this one, which
+//    keeps the order of output sent to two descriptors.  Example:
+//       fd_buffer out (1, 1 << 16, false);
+//       fd_buffer err (2, 1 << 10, true, &out);
+
+class fd_buffer: public streambuf {
+   private:
+      int fd;
+      vector<char> buffer;
+      bool write_on_sync;
+      fd_buffer* preceding;
+      void write_out();
+   protected:
+      virtual int_type overflow (int_type ch) override;
+      virtual int sync() override;
+   public:
+      fd_buffer (int fd, size_t size, bool write_on_sync,
+                 fd_buffer* preceding = nullptr);
+      fd_buffer (const fd_buffer&) = delete;
+      fd_buffer& operator= (const fd_buffer&) = delete;
+      ~fd_buffer();
+      void flush();
+};
+
+// worker_pool -
+//    A fixed set of threads that run the tasks of one job at a time.
+//    run calls task (index) for every index below count, spread over
+//    the workers and the calling thread, and returns when all are
+//    done.  Indices are handed out one at a time as threads become
+//    free, so tasks of uneven size balance out.  If another thread
+//    is already running a job, or there is only one task, the caller
+//    runs them all itself rather than wait.
+// size -
+//    The number of threads that work on a job, counting the caller.
+
+class worker_pool {
+   private:
+      vector<thread> workers;
+      mutex lock;
+      mutex running;
+      condition_variable wake;
+      condition_variable done;
+      const function<void (size_t)>* task {nullptr};
+      size_t count {0};
+      atomic<size_t> next {0};
+      size_t busy {0};
+      size_t generation {0};
+      bool stopping {false};
+      void work();
+      void take_tasks (const function<void (size_t)>& job,
+                       size_t job_count);
+   public:
+      explicit worker_pool (size_t threads);
+      worker_pool (const worker_pool&) = delete;
+      worker_pool& operator= (const worker_pool&) = delete;
+      ~worker_pool();
+      void run (size_t count, const function<void (size_t)>& task);
+      size_t size() const { return workers.size() + 1; }
+};
+
+// journal -
+//    An append-only file of records, such as the changes made to a
+//    tree, which can be read back after a crash.  The file starts
+//    with a magic number "ysj" and a version byte, and each record
+//    is its length and a checksum of its bytes, both 32 bits and
+//    little-endian, followed by the bytes.  Records are written by
+//    a thread of its own.  append only adds a record to a buffer,
+//    and wakes the writer if it is idle.  The writer takes everything
+//    in the buffer, writes it and calls fdatasync, and then does the
+//    same for whatever was appended meanwhile.  So the records of
+//    many commands share one sync (group commit), appending never
+//    waits for the disk, and a crash loses only what was appended
+//    since the last sync began.
+// open -
+//    Opens the journal, creating it if need be, and first passes
+//    each record already in it to replay, in order.  A record cut off
+//    or garbled by a crash ends the journal, and is truncated away
+//    so new records follow the last good one.  Returns the number of
+//    records replayed, or the failure of the first that could not
+//    be, in which case the journal is not opened.
+// close -
+//    Writes and syncs everything appended, and stops the writer.
+//    Returns the first error the writer had, if any, after which it
+//    stopped writing.  The destructor closes the journal too.
+
+class journal {
+   public:
+      using replay_fn = function<result<> (string_view record)>;
+   private:
+      int fd {-1};
+      thread writer;
+      mutex lock;
+      condition_variable wake;
+      string pending;
+      string writing;
+      const char* error {nullptr};
+      bool stopping {false};
+      bool idle {false};
+      void write_out();
+   public:
+      journal() = default;
+      journal (const journal&) = delete;
+      journal& operator= (const journal&) = delete;
+      ~journal();
+      result<size_t> open (const string& filename,
+                           const replay_fn& replay);
+      void append (string_view record);
+      result<> close();
+};
+
 // operator<< (vector) -
 //    An overloaded template operator which allows vectors to be
 //    printed out as a single operator, each element separated from
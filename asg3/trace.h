@@ -4,9 +4,10 @@
 #ifndef __TRACE_H__
 #define __TRACE_H__
 
+#include <bitset>
+#include <climits>
 #include <iostream>
 #include <string>
-#include <vector>
 
 using namespace std;
 
@@ -19,15 +20,21 @@ using namespace std;
 //    string.  As a special case, '@', sets all flags.
 // getflag -
 //    Used by the TRACE macro to check to see if a flag has been set.
-//    Not to be called by user code.
+//    Not to be called by user code.  Defined inline so that a trace
+//    whose flag is off costs one load and a predicted branch.
 //
 
 class traceflags {
    private:
-      static vector<char> flags;
+      using flagset = bitset<UCHAR_MAX + 1>;
+      static flagset flags;
    public:
       static void setflags (const string& optflags);
-      static bool getflag (char flag);
+      static bool getflag (char flag) {
+         // Bug alert:
+         // Don't TRACE this function or the stack will blow up.
+         return flags[static_cast<unsigned char> (flag)];
+      }
 };
 
 //
@@ -39,8 +46,12 @@ class traceflags {
 //       TRACE ('u', "foo = " << foo);
 //    will print two words and a newline if flag 'u' is  on.
 //    Traces are preceded by filename, line number, and function.
+//    When compiled with -DNDEBUG, traces expand to nothing.
 //
 
+#ifdef NDEBUG
+#define TRACE(FLAG,CODE) ;
+#else
 #define TRACE(FLAG,CODE) { \
            if (traceflags::getflag (FLAG)) { \
               cerr << "[" << __FILE__ << ":" << __LINE__ << ":" \
@@ -48,6 +59,7 @@ class traceflags {
               cerr << CODE << endl; \
            } \
         }
+#endif
 
 #endif
 
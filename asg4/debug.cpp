@@ -1,21 +1,19 @@
 // $Id: debug.cpp,v 1.1 2016-02-28 21:56:10-08 - - $
 // Ana Carolina Alves - adalves
 
-#include <cassert>
 #include <climits>
 #include <iostream>
-#include <vector>
 using namespace std;
 
 #include "debug.h"
 #include "util.h"
 
-vector<bool> debugflags::flags (UCHAR_MAX + 1, false);
+debugflags::flagset debugflags::flags {};
 
 void debugflags::setflags (const string& initflags) {
-   for (const char flag: initflags) {
-      if (flag == '@') flags.assign (flags.size(), true);
-                  else flags[flag] = true;
+   for (const unsigned char flag: initflags) {
+      if (flag == '@') flags.set();
+                  else flags.set (flag, true);
    }
    // Note that DEBUGF can trace setflags.
    if (getflag ('x')) {
@@ -26,18 +24,6 @@ void debugflags::setflags (const string& initflags) {
    }
 }
 
-//
-// getflag -
-//    Check to see if a certain flag is on.
-//
-
-bool debugflags::getflag (char flag) {
-   // WARNING: Don't TRACE this function or the stack will blow up.
-   unsigned uflag = (unsigned char) flag;
-   assert (uflag < flags.size());
-   return flags[uflag];
-}
-
 void debugflags::where (char flag, const char* file, int line,
                         const char* func) {
    cout << sys_info::execname() << ": DEBUG(" << flag << ") "
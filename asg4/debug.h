@@ -4,8 +4,9 @@
 #ifndef __DEBUG_H__
 #define __DEBUG_H__
 
+#include <bitset>
+#include <climits>
 #include <string>
-#include <vector>
 using namespace std;
 
 //
@@ -17,15 +18,19 @@ using namespace std;
 //    string.  As a special case, '@', sets all flags.
 // getflag -
 //    Used by the DEBUGF macro to check to see if a flag has been set.
-//    Not to be called by user code.
+//    Not to be called by user code.  Defined inline so that a trace
+//    whose flag is off costs one load and a predicted branch.
 //
 
 class debugflags {
    private:
-      static vector<bool> flags;
+      using flagset = bitset<UCHAR_MAX + 1>;
+      static flagset flags;
    public:
       static void setflags (const string& optflags);
-      static bool getflag (char flag);
+      static bool getflag (char flag) {
+         return flags[static_cast<unsigned char> (flag)];
+      }
       static void where (char flag, const char* file, int line,
                          const char* func);
 };
@@ -40,6 +45,7 @@ class debugflags {
 //       DEBUGF ('u', "foo = " << foo);
 //    will print two words and a newline if flag 'u' is  on.
 //    Traces are preceded by filename, line number, and function.
+//    When compiled with -DNDEBUG, traces expand to nothing.
 //
 
 #ifdef NDEBUG